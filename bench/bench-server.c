@@ -0,0 +1,250 @@
+/**
+ * bench-server.c
+ *
+ * Toke Høiland-Jørgensen
+ * 2026-10-17
+ *
+ * Minimal HTTP/1.1 server for benchmarking http-getter on loopback. Every
+ * request gets a response shaped by its query string:
+ *
+ *   /?size=<bytes>&delay=<ms>&status=<code>
+ *
+ * (defaults 0, 0 and 200). Connections are kept alive unless the client asks
+ * otherwise, and each connection is served by its own thread so delays do not
+ * hold up other requests.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#define REQ_BUFSIZE 8192
+#define BODY_CHUNK 65536
+
+static char body[BODY_CHUNK];
+
+struct request {
+	long size;
+	long delay;
+	int status;
+	int head;
+	int close;
+};
+
+static const char *status_text(int status)
+{
+	switch(status) {
+	case 200: return "OK";
+	case 204: return "No Content";
+	case 301: return "Moved Permanently";
+	case 302: return "Found";
+	case 304: return "Not Modified";
+	case 400: return "Bad Request";
+	case 403: return "Forbidden";
+	case 404: return "Not Found";
+	case 500: return "Internal Server Error";
+	case 502: return "Bad Gateway";
+	case 503: return "Service Unavailable";
+	default: return "Unknown";
+	}
+}
+
+static int write_all(int fd, const char *buf, size_t len)
+{
+	ssize_t n;
+	while(len) {
+		if((n = write(fd, buf, len)) < 0) {
+			if(errno == EINTR) continue;
+			return -1;
+		}
+		buf += n;
+		len -= n;
+	}
+	return 0;
+}
+
+/* Parse the request line and headers held in buf (terminated by the blank
+ * line). */
+static int parse_request(char *buf, struct request *req)
+{
+	char *line, *query, *param, *val, *save = NULL, *save_p = NULL;
+
+	req->size = 0;
+	req->delay = 0;
+	req->status = 200;
+	req->head = 0;
+	req->close = 0;
+
+	if(!(line = strtok_r(buf, "\r\n", &save)))
+		return -1;
+	if(strncmp(line, "HEAD ", 5) == 0)
+		req->head = 1;
+	else if(strncmp(line, "GET ", 4))
+		return -1;
+	if(strstr(line, "HTTP/1.0"))
+		req->close = 1;
+	if((query = strchr(line, '?'))) {
+		if((val = strchr(query, ' ')))
+			*val = '\0';
+		for(param = strtok_r(query + 1, "&", &save_p); param; param = strtok_r(NULL, "&", &save_p)) {
+			if(!(val = strchr(param, '=')))
+				continue;
+			*val++ = '\0';
+			if(strcmp(param, "size") == 0)
+				req->size = atol(val);
+			else if(strcmp(param, "delay") == 0)
+				req->delay = atol(val);
+			else if(strcmp(param, "status") == 0)
+				req->status = atoi(val);
+		}
+	}
+	while((line = strtok_r(NULL, "\r\n", &save))) {
+		if(strncasecmp(line, "Connection:", 11) == 0 && strcasestr(line + 11, "close"))
+			req->close = 1;
+	}
+	if(req->size < 0 || req->delay < 0 || req->status < 100 || req->status > 999)
+		return -1;
+	return 0;
+}
+
+static int respond(int fd, const struct request *req)
+{
+	struct timespec delay;
+	char head[256];
+	long left;
+	int len;
+
+	if(req->delay) {
+		delay.tv_sec = req->delay / 1000;
+		delay.tv_nsec = (req->delay % 1000) * 1000000;
+		while(nanosleep(&delay, &delay) && errno == EINTR);
+	}
+	len = snprintf(head, sizeof(head), "HTTP/1.1 %d %s\r\nContent-Length: %ld\r\n%s\r\n",
+		       req->status, status_text(req->status), req->size,
+		       req->close ? "Connection: close\r\n" : "");
+	if(write_all(fd, head, len))
+		return -1;
+	for(left = req->head ? 0 : req->size; left > 0; left -= BODY_CHUNK) {
+		if(write_all(fd, body, left < BODY_CHUNK ? left : BODY_CHUNK))
+			return -1;
+	}
+	return 0;
+}
+
+static void *serve(void *arg)
+{
+	int fd = (int)(long)arg;
+	char buf[REQ_BUFSIZE+1];
+	size_t len = 0, hlen;
+	struct request req;
+	char *end;
+	ssize_t n;
+
+	while(1) {
+		buf[len] = '\0';
+		if(!(end = strstr(buf, "\r\n\r\n"))) {
+			if(len == REQ_BUFSIZE)
+				break;
+			if((n = read(fd, buf + len, REQ_BUFSIZE - len)) < 0 && errno == EINTR)
+				continue;
+			if(n <= 0)
+				break;
+			len += n;
+			continue;
+		}
+		hlen = end + 4 - buf;
+		end[2] = '\0';
+		if(parse_request(buf, &req)) {
+			req.size = 0;
+			req.delay = 0;
+			req.status = 400;
+			req.head = 0;
+			req.close = 1;
+		}
+		if(respond(fd, &req) || req.close)
+			break;
+		memmove(buf, buf + hlen, len - hlen);
+		len -= hlen;
+	}
+	close(fd);
+	return NULL;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-h] [-p <port>]\n", name);
+}
+
+int main(int argc, char **argv)
+{
+	struct sockaddr_in addr = {0};
+	socklen_t addrlen = sizeof(addr);
+	pthread_attr_t attr;
+	pthread_t thread;
+	int o, fd, cfd, one = 1, port = 0;
+
+	while((o = getopt(argc, argv, "hp:")) != -1) {
+		switch(o) {
+		case 'p':
+			port = atoi(optarg);
+			if(port < 0 || port > 65535) {
+				fprintf(stderr, "Invalid port: %d\n", port);
+				return 1;
+			}
+			break;
+		case 'h':
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	memset(body, 'x', sizeof(body));
+	signal(SIGPIPE, SIG_IGN);
+
+	if((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+		perror("socket()");
+		return 1;
+	}
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons(port);
+	if(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+	   listen(fd, SOMAXCONN) ||
+	   getsockname(fd, (struct sockaddr *)&addr, &addrlen)) {
+		perror("bind()");
+		return 1;
+	}
+
+	/* The port goes on stdout, so a driver can use an ephemeral one. */
+	printf("%d\n", ntohs(addr.sin_port));
+	fflush(stdout);
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	while(1) {
+		if((cfd = accept(fd, NULL, NULL)) < 0) {
+			if(errno == EINTR || errno == ECONNABORTED) continue;
+			perror("accept()");
+			return 1;
+		}
+		setsockopt(cfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		if(pthread_create(&thread, &attr, serve, (void *)(long)cfd)) {
+			perror("pthread_create()");
+			close(cfd);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,116 @@
+#!/bin/sh
+#
+# run-bench.sh
+#
+# Toke Høiland-Jørgensen
+# 2026-10-17
+#
+# Run http-getter against the loopback bench-server for each engine and worker
+# count, and report:
+#
+#   cycles/s   back-to-back closed-loop cycles per second
+#   req avg/p99  request time (us) for an empty response with no server delay,
+#              i.e. what the tool and the loopback round trip add per request
+#   lag avg/p99/max  how late cycles start (us) on a fixed open-loop schedule
+#
+# Usage: run-bench.sh <http-getter> <bench-server>
+#
+# The environment variables below override the defaults.
+
+GETTER=${1:?Usage: $0 <http-getter> <bench-server>}
+SERVER=${2:?Usage: $0 <http-getter> <bench-server>}
+
+ENGINES=${BENCH_ENGINES:-"fork multi thread"}
+WORKERS=${BENCH_WORKERS:-"1 4 16"}
+CYCLES=${BENCH_CYCLES:-500}
+URLS=${BENCH_URLS:-16}
+SIZE=${BENCH_SIZE:-0}
+INTERVAL=${BENCH_INTERVAL:-5}
+
+TMPDIR=$(mktemp -d) || exit 1
+SERVER_PID=
+
+cleanup()
+{
+	[ -n "$SERVER_PID" ] && kill "$SERVER_PID" 2>/dev/null
+	rm -rf "$TMPDIR"
+}
+trap cleanup EXIT
+trap 'exit 1' INT TERM
+
+"$SERVER" -p 0 > "$TMPDIR/port" &
+SERVER_PID=$!
+while [ ! -s "$TMPDIR/port" ]; do
+	kill -0 "$SERVER_PID" 2>/dev/null || { echo "bench-server failed to start" >&2; exit 1; }
+	sleep 0.1
+done
+PORT=$(cat "$TMPDIR/port")
+
+i=0
+while [ $i -lt "$URLS" ]; do
+	echo "http://127.0.0.1:$PORT/?size=$SIZE&n=$i"
+	i=$((i + 1))
+done > "$TMPDIR/urls"
+
+# Summarise the JSON Lines output of one run.
+summarise()
+{
+	awk '
+	function field(name,   m) {
+		if(match($0, "\"" name "\":-?[0-9]+")) {
+			m = substr($0, RSTART, RLENGTH)
+			sub(/.*:/, "", m)
+			return m + 0
+		}
+		return 0
+	}
+	function pct(a, n, p,   i) {
+		if(n == 0) return 0
+		i = int(p / 100 * n + 0.5)
+		if(i < 1) i = 1
+		return a[i]
+	}
+	function sort(a, n,   i, j, t) {
+		# Shell sort; awk has no portable sort.
+		for(gap = int(n / 2); gap > 0; gap = int(gap / 2))
+			for(i = gap + 1; i <= n; i++)
+				for(j = i; j > gap && a[j - gap] > a[j]; j -= gap) {
+					t = a[j]; a[j] = a[j - gap]; a[j - gap] = t
+				}
+	}
+	/"type":"request"/ && field("url") >= 0 {
+		req[++nreq] = field("total_us"); reqsum += req[nreq]
+	}
+	/"type":"cycle"/ {
+		ts = field("timestamp_us")
+		if(!first) first = ts
+		last = ts
+		lag[++ncyc] = field("lag_us"); lagsum += lag[ncyc]
+		if(field("status")) errors++
+	}
+	END {
+		sort(req, nreq); sort(lag, ncyc)
+		printf "%s %s %s %s %s %s %s %s\n",
+			(ncyc > 1 && last > first) ? sprintf("%.0f", (ncyc - 1) * 1000000 / (last - first)) : "-",
+			nreq ? sprintf("%.0f", reqsum / nreq) : "-", pct(req, nreq, 99),
+			ncyc ? sprintf("%.0f", lagsum / ncyc) : "-", pct(lag, ncyc, 99), ncyc ? lag[ncyc] : "-",
+			errors + 0, ncyc + 0
+	}'
+}
+
+run()
+{
+	"$GETTER" -F json -c "$CYCLES" "$@" "$TMPDIR/urls" 2>"$TMPDIR/err" | summarise
+}
+
+printf "%-6s %7s %9s %14s %20s %6s\n" engine workers cycles/s "req avg/p99" "lag avg/p99/max" errors
+for engine in $ENGINES; do
+	for workers in $WORKERS; do
+		set -- $(run -e "$engine" -n "$workers" -i 0)
+		rate=$1 req_avg=$2 req_p99=$3 errors=$7
+		set -- $(run -e "$engine" -n "$workers" -a fixed -i "$INTERVAL")
+		errors=$((errors + $7))
+		printf "%-6s %7s %9s %14s %20s %6s\n" "$engine" "$workers" "$rate" \
+			"$req_avg/$req_p99" "$4/$5/$6" "$errors"
+	done
+done
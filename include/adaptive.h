@@ -0,0 +1,30 @@
+/**
+ * adaptive.h
+ *
+ * Toke Høiland-Jørgensen
+ * 2026-10-17
+ */
+
+#ifndef ADAPTIVE_H
+#define ADAPTIVE_H
+
+/* Adaptive concurrency: after every cycle, the number of requests the engine
+ * runs at once is scaled towards holding a target cycle time, or a target
+ * request rate, within 1 and the -n maximum. */
+#define ADAPT_NONE 0
+#define ADAPT_CYCLE_TIME 1
+#define ADAPT_RATE 2
+
+struct adaptive {
+	int mode;
+	double target;
+	int max;
+	int current;
+	int low;
+	int high;
+};
+
+void adaptive_init(struct adaptive *a, int mode, double target, int max);
+int adaptive_update(struct adaptive *a, int requests, long long duration_ns);
+
+#endif
@@ -0,0 +1,19 @@
+/**
+ * crc32c.h
+ *
+ * Toke Høiland-Jørgensen
+ * 2026-10-17
+ */
+
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* CRC32C (Castagnoli) of a buffer, continuing from the CRC of what came
+ * before it (0 to start). crc32c_init() has to have been called first. */
+void crc32c_init();
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len);
+
+#endif
@@ -0,0 +1,80 @@
+/**
+ * cycle.h
+ *
+ * Toke Høiland-Jørgensen
+ * 2026-10-17
+ */
+
+#ifndef CYCLE_H
+#define CYCLE_H
+
+#include <time.h>
+#include "stats.h"
+#include "urls.h"
+#include "listcache.h"
+
+#define LIST_NONE 0
+#define LIST_PENDING 1
+#define LIST_FETCHING 2
+
+/* One pass over the URL list. Engines pull work from the queue of cycles in
+ * flight (oldest first), so in open-loop mode several cycles can be running
+ * at once. A cycle that is still running at its deadline (all zero if it has
+ * none) is expired: nothing more is dispatched for it, and the requests that
+ * do not make it are counted as missed rather than as errors. A request that
+ * has been running for hedge_ns (if set) gets a duplicate, and whichever of
+ * the two finishes first is the result. The concurrency is how many requests
+ * the engine was allowed to run at once when the cycle started. A cycle with
+ * indexes (a slice of a replayed trace, or URLs sampled from its table) gets
+ * just those URLs of its table, in that order, rather than all of them. */
+struct cycle {
+	struct cycle *next;
+	int id;
+	struct timespec intended;
+	struct timespec start;
+	struct timespec end;
+	struct timespec deadline;
+	int expired;
+	long long hedge_ns;
+	int concurrency;
+	struct url_table *urls;
+	int *indexes;
+	size_t nindexes;
+	struct url_list *list;
+	char *urls_loc;
+	int list_state;
+	int list_status;
+	curl_off_t list_time;
+	struct timespec list_done;
+	size_t cururl;
+	int active;
+	long bytes;
+	int err;
+	struct cycle_stats stats;
+};
+
+/* The URL index of the request at position pos of a cycle. */
+static inline int cycle_url(const struct cycle *c, size_t pos)
+{
+	return c->indexes ? c->indexes[pos] : (int)pos;
+}
+
+void cycles_init(void (*request_done)(const struct cycle *c, const struct result *r),
+		 void (*done)(struct cycle *c), void (*pick)(struct cycle *c));
+struct cycle *cycle_new(int id, struct url_table *urls, char *urls_loc);
+void cycle_start(struct cycle *c);
+int cycles_running();
+const struct timespec *cycles_next_deadline();
+void cycles_expire();
+int cycle_take(struct cycle **c, int *url);
+int cycle_take_batch(struct cycle **c, int *url, int *count);
+void cycle_set_list(struct cycle *c, struct url_list *list, int status);
+void cycle_add_result(struct cycle *c, struct result *r);
+void cycle_add_batch(struct cycle *c, const struct cycle_stats *cs, int err,
+		     const struct result *results, int n);
+void cycle_free(struct cycle *c);
+int deadline_passed(const struct timespec *deadline);
+int deadline_missed(const struct timespec *deadline, int status);
+long deadline_left_ms(const struct timespec *deadline);
+
+#endif
@@ -0,0 +1,44 @@
+/**
+ * decode.h
+ *
+ * Toke Høiland-Jørgensen
+ * 2026-10-17
+ */
+
+#ifndef DECODE_H
+#define DECODE_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+struct result;
+
+/* Content decoding done by the write callback rather than by cURL, so that the
+ * bytes on the wire and the CPU time spent decoding them can be told apart.
+ * A body in an encoding that was not asked for (or that this build cannot
+ * decode) is passed through as it is, as ENCODING_OTHER. */
+#define ENCODING_IDENTITY 0
+#define ENCODING_GZIP 1
+#define ENCODING_DEFLATE 2
+#define ENCODING_BROTLI 3
+#define ENCODING_ZSTD 4
+#define ENCODING_OTHER 5
+#define NUM_ENCODINGS 6
+
+typedef int (*decode_sink)(void *ctx, const void *buf, size_t len);
+
+struct decoder;
+
+char *encodings_accept(const char *list);
+struct decoder *decoder_new();
+void decoder_free(struct decoder *d);
+void decoder_reset(struct decoder *d);
+int decoder_started(const struct decoder *d);
+int decoder_start(struct decoder *d, const char *content_encoding);
+int decoder_write(struct decoder *d, const void *buf, size_t len, decode_sink sink, void *ctx);
+void decoder_result(const struct decoder *d, struct result *r);
+const char *encoding_name(int encoding);
+void decode_stats_add(const struct result *r);
+void decode_stats_print(FILE *output);
+
+#endif
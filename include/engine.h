@@ -0,0 +1,35 @@
+/**
+ * engine.h
+ *
+ * Toke Høiland-Jørgensen
+ * 2026-10-17
+ */
+
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include <time.h>
+#include "options.h"
+#include "cycle.h"
+
+/* An engine executes the requests of the cycles in flight. poll() dispatches
+ * queued work and processes results until the absolute CLOCK_MONOTONIC time
+ * in *until has passed, or (if until is NULL) until nothing is left running.
+ * It returns early if a signal interrupts its wait, and a negative value on
+ * fatal errors. set_concurrency() limits how
+ * many requests are started at once, up to the -n the engine was set up with;
+ * requests already running above a lowered limit are left to finish. */
+struct engine {
+	const char *name;
+	int (*init)(struct options *opt);
+	int (*start_cycle)(struct cycle *c);
+	int (*poll)(const struct timespec *until);
+	void (*set_concurrency)(int n);
+	void (*destroy)();
+};
+
+extern struct engine fork_engine;
+extern struct engine multi_engine;
+extern struct engine thread_engine;
+
+#endif
@@ -8,10 +8,13 @@
 #ifndef GETTER_H
 #define GETTER_H
 
+#include <signal.h>
 #include <curl/curl.h>
 #include "options.h"
 
-#define USLEEP_THRESHOLD 10000
+/* The signal that stopped the run, if any; get_loop() returns soon after it
+ * is set. */
+extern volatile sig_atomic_t interrupted;
 
 int get_loop(struct options *opt);
 void print_stats(FILE *output);
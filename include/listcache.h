@@ -0,0 +1,35 @@
+/**
+ * listcache.h
+ *
+ * Toke Høiland-Jørgensen
+ * 2026-10-17
+ */
+
+#ifndef LISTCACHE_H
+#define LISTCACHE_H
+
+#include <time.h>
+#include "urls.h"
+
+/* A fetched URL list, shared (by reference count) between the cache and the
+ * cycles using it. */
+struct url_list {
+	struct url_table urls;
+	int refs;
+};
+
+#define LIST_FETCHED 0
+#define LIST_NOT_MODIFIED 1
+#define LIST_CACHED 2
+
+struct url_list *url_list_new();
+void url_list_put(struct url_list *l);
+
+void list_cache_init(int min_refresh_ms);
+void list_cache_destroy();
+struct url_list *list_cache_get();
+const char *list_cache_etag();
+const char *list_cache_last_modified();
+struct url_list *list_cache_update(long code, struct url_list *fresh, const char *etag, const char *last_modified);
+
+#endif
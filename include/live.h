@@ -0,0 +1,22 @@
+/**
+ * live.h
+ *
+ * Toke Høiland-Jørgensen
+ * 2026-10-17
+ */
+
+#ifndef LIVE_H
+#define LIVE_H
+
+#include "cycle.h"
+#include "transfer.h"
+
+/* Running totals served on a Unix domain socket while the loop runs. A client
+ * that connects gets a snapshot and the connection is closed; it can send
+ * "json" first to get JSON rather than "name value" lines. */
+int live_init(const char *path);
+void live_request(const struct cycle *c, const struct result *r);
+void live_cycle(const struct cycle *c, long long duration_ns, int ok);
+void live_destroy();
+
+#endif
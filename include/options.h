@@ -15,9 +15,19 @@
 #include <unistd.h>
 #include <errno.h>
 #include <stdio.h>
+#include "urls.h"
 
-#define MAX_URLS 1024
+#define ENGINE_FORK 0
+#define ENGINE_MULTI 1
+#define ENGINE_THREAD 2
 
+#define HTTP_VERSION_DEFAULT 0
+#define HTTP_VERSION_1_1 1
+#define HTTP_VERSION_2 2
+#define HTTP_VERSION_2_PRIOR 3
+#define HTTP_VERSION_3 4
+
+struct profile;
 
 struct options {
 	char initialised;
@@ -26,13 +36,35 @@ struct options {
 	int interval;
 	int count;
 	int timeout;
+	int deadline;
+	struct profile *profile;
+	int hedge_delay;
+	double hedge_percentile;
 	char *dns_servers;
 	int ai_family;
 	int workers;
+	int adapt_mode;
+	double adapt_target;
+	int engine;
+	int keepalive;
+	int schedule;
+	int list_refresh;
+	int resolve_refresh;
+	int url_stats;
+	int verify;
+	char *encodings;
+	int throughput_interval;
+	int sample_mode;
+	double zipf_s;
+	int sample_count;
+	char *stats_socket;
+	char *trace_out;
+	char *replay;
+	int http_version;
+	int format;
 	struct timeval start_time;
 	FILE *output;
-	char *urls[MAX_URLS];
-	size_t urls_l;
+	struct url_table urls;
 	char *urls_loc;
 };
 
@@ -0,0 +1,116 @@
+/**
+ * output.h
+ *
+ * Toke Høiland-Jørgensen
+ * 2026-10-17
+ */
+
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "cycle.h"
+#include "transfer.h"
+#include "urlstats.h"
+
+/* Text is the human-readable line per cycle. The structured formats write one
+ * record per request and one per cycle: JSON Lines, or fixed-size binary
+ * records. Both are written through a large buffer and only flushed when it
+ * fills up or at the end of the run. */
+#define FORMAT_TEXT 0
+#define FORMAT_JSON 1
+#define FORMAT_BINARY 2
+
+#define RECORD_HEADER 0
+#define RECORD_REQUEST 1
+#define RECORD_CYCLE 2
+#define RECORD_HOST 3
+#define RECORD_URL 4
+
+#define RECORD_MAGIC 0x48474554 /* "HGET" */
+#define RECORD_VERSION 8
+
+/* Binary records are all the same size and in host byte order; a reader can
+ * tell the byte order from the magic in the header record that starts the
+ * file. Times are in microseconds, timestamps in microseconds since the epoch.
+ * The URL list fetch of a cycle is a request record with url -1; the body
+ * digest and the outcome of checking it (see verify.h) are only set with -v,
+ * the content encoding fields (see decode.h) with -C, and the goodput fields
+ * (see throughput.h) with -g, and ramp_ns is -1 when there is no ramp-up
+ * time. The JSON output leaves out the fields of -v, -C and -g when they are
+ * off, and is the only one with the goodput curve itself. With per-URL
+ * statistics, the run ends with a host record for each host (numbered in the
+ * order they were first seen; the names are only in the JSON output) and a url
+ * record for each URL, with cycle -1. */
+struct record {
+	uint32_t type;
+	int32_t cycle;
+	union {
+		struct {
+			uint32_t magic;
+			uint32_t version;
+			uint32_t size;
+			uint32_t pad;
+			int64_t start;
+		} header;
+		struct {
+			int32_t url;
+			int32_t status;
+			int32_t code;
+			int32_t connects;
+			int32_t hedge;
+			int32_t verify;
+			int64_t bytes;
+			int64_t times[NUM_TIMES];
+			uint32_t digest;
+			int32_t encoding;
+			int64_t wire_bytes;
+			int64_t decoded_bytes;
+			int64_t decode_ns;
+			int32_t samples;
+			int32_t stalls;
+			int64_t body_ns;
+			int64_t ramp_ns;
+			int64_t stall_ns;
+			int64_t peak_rate;
+		} request;
+		struct {
+			int32_t status;
+			int32_t requests;
+			int32_t errors;
+			int32_t list_status;
+			int32_t missed;
+			int32_t hedged;
+			int32_t hedge_wins;
+			int32_t concurrency;
+			int64_t bytes;
+			int64_t connects;
+			int64_t timestamp;
+			int64_t duration;
+			int64_t lag;
+			int64_t list_time;
+		} cycle;
+		struct {
+			int32_t url;
+			int32_t host;
+			int32_t requests;
+			int32_t errors;
+			int64_t bytes;
+			int64_t avg;
+			int64_t p50;
+			int64_t p90;
+			int64_t p99;
+			int64_t max;
+		} stats;
+	} u;
+};
+
+int output_init(FILE *f, int format, int verifying, int decoding, int goodput);
+void output_request(const struct cycle *c, const struct result *r);
+void output_cycle(const struct cycle *c, long long duration_ns, long long lag_ns);
+void output_host_stats(int host, const char *name, const struct url_stats *s);
+void output_url_stats(int url, const char *name, int host, const struct url_stats *s);
+void output_flush();
+
+#endif
@@ -0,0 +1,78 @@
+/**
+ * profile.h
+ *
+ * Toke Høiland-Jørgensen
+ * 2026-10-17
+ */
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdio.h>
+#include <time.h>
+#include "cycle.h"
+#include "stats.h"
+#include "transfer.h"
+
+/* A load profile is a sequence of stages, each holding the cycle rate (in
+ * cycles per second) or the concurrency at a constant value, ramping it
+ * linearly, or stepping it, for a number of seconds:
+ *
+ *   rate:10:30        10 cycles/s for 30 s
+ *   rate:10-100:60    ramp from 10 to 100 cycles/s over 60 s
+ *   conc:1-32/8:80    8 steps of 10 s each, from concurrency 1 up to 32
+ *
+ * Stages are separated by commas, or given one per line in a file; a stage
+ * leaves whichever of the two it is not about where the stages before it set
+ * it (or at -i and -n). The run is divided into levels (each step, a tenth of
+ * each ramp, each constant stage), and the results are totalled per level to
+ * find where the latency or error rate breaks away from that at the lower
+ * levels. A concurrency holds at its level's load, rounded to whole workers
+ * and no more than -n, for as long as the level lasts. */
+#define PROFILE_RATE 0
+#define PROFILE_CONC 1
+
+struct profile_stage {
+	int kind;
+	double from;
+	double to;
+	int steps;
+	long long duration_ns;
+};
+
+struct profile_level {
+	int index;
+	int stage;
+	double load;
+	int first_cycle;
+	int cycles;
+	int missed;
+	uint32_t requests;
+	uint32_t errors;
+	long long elapsed_ns;
+	struct compact_histogram hist;
+};
+
+struct profile {
+	struct profile_stage *stages;
+	int nstages;
+	int has_rate;
+	int has_conc;
+	struct profile_level *levels;
+	int nlevels;
+	struct timespec start;
+	struct timespec level_start;
+	int stage;
+	int max_conc;
+};
+
+struct profile *profile_parse(const char *spec);
+void profile_free(struct profile *p);
+void profile_start(struct profile *p, const struct timespec *now, int max_conc);
+int profile_next(struct profile *p, const struct timespec *now, int next_cycle,
+		 double *rate, double *conc);
+void profile_add_result(struct profile *p, const struct cycle *c, const struct result *r);
+void profile_add_cycle(struct profile *p, int cycle, int missed);
+void profile_print(struct profile *p, FILE *output);
+
+#endif
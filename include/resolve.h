@@ -0,0 +1,33 @@
+/**
+ * resolve.h
+ *
+ * Toke Høiland-Jørgensen
+ * 2026-10-17
+ */
+
+#ifndef RESOLVE_H
+#define RESOLVE_H
+
+#include <curl/curl.h>
+#include "cycle.h"
+#include "options.h"
+#include "stats.h"
+
+/* The CURLOPT_RESOLVE entries ("host:port:addr,...") for every name in the URL
+ * table, shared (by reference count) between the resolver and the handles
+ * they were given to. Each refresh installs a new list with a new
+ * generation. */
+struct resolve_list {
+	struct curl_slist *entries;
+	unsigned int generation;
+	int refs;
+};
+
+int resolve_init(struct options *opt, struct histogram *hist);
+void resolve_destroy();
+struct resolve_list *resolve_get();
+void resolve_put(struct resolve_list *list);
+int resolve_update();
+void resolve_cycle(const struct cycle *c);
+
+#endif
@@ -0,0 +1,37 @@
+/**
+ * ring.h
+ *
+ * Toke Høiland-Jørgensen
+ * 2026-10-17
+ */
+
+#ifndef RING_H
+#define RING_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include "transfer.h"
+
+/* Single-producer, single-consumer ring of results in memory shared between a
+ * worker process (the producer) and the parent. A worker only ever has one
+ * request outstanding, so the ring never needs to be large. The parent cancels
+ * a request by storing its sequence number in cancel. */
+#define RING_SIZE 16
+#define RING_CACHELINE 64
+
+struct result_ring {
+	_Atomic uint32_t head;
+	char pad0[RING_CACHELINE - sizeof(uint32_t)];
+	_Atomic uint32_t tail;
+	char pad1[RING_CACHELINE - sizeof(uint32_t)];
+	_Atomic uint32_t cancel;
+	char pad2[RING_CACHELINE - sizeof(uint32_t)];
+	struct result slots[RING_SIZE];
+};
+
+struct result_ring *ring_create();
+void ring_destroy(struct result_ring *ring);
+int ring_push(struct result_ring *ring, const struct result *r);
+int ring_pop(struct result_ring *ring, struct result *r);
+
+#endif
@@ -0,0 +1,28 @@
+/**
+ * sample.h
+ *
+ * Toke Høiland-Jørgensen
+ * 2026-10-17
+ */
+
+#ifndef SAMPLE_H
+#define SAMPLE_H
+
+#include "cycle.h"
+
+/* URL sampling: rather than every URL of the list once, each cycle gets a
+ * number of URLs drawn (independently, with replacement) from a distribution
+ * over the list. Uniform gives every URL the same chance; Zipf weights the URL
+ * on line k by 1/k^s, so the top of the list is the most popular; weighted
+ * takes the weight of each URL from a number given after it on its line (URLs
+ * without one weigh 1). */
+#define SAMPLE_NONE 0
+#define SAMPLE_UNIFORM 1
+#define SAMPLE_ZIPF 2
+#define SAMPLE_WEIGHTED 3
+
+int sample_init(int mode, double zipf_s, int count, struct url_table *urls);
+void sample_cycle(struct cycle *c);
+void sample_destroy();
+
+#endif
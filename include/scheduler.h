@@ -0,0 +1,35 @@
+/**
+ * scheduler.h
+ *
+ * Toke Høiland-Jørgensen
+ * 2026-10-17
+ */
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <time.h>
+
+/* Closed loop: the next cycle starts one interval after the previous one
+ * started, and never before it has completed. Open loop (fixed or Poisson
+ * arrivals): cycles start at their intended times regardless of whether
+ * earlier cycles are still running. */
+#define SCHED_CLOSED 0
+#define SCHED_FIXED 1
+#define SCHED_POISSON 2
+
+struct scheduler {
+	int mode;
+	long long interval_ns;
+	struct timespec next;
+	unsigned short xsubi[3];
+};
+
+void sched_init(struct scheduler *s, int mode, int interval_ms);
+void sched_next(struct scheduler *s, struct timespec *intended);
+void sched_set_interval(struct scheduler *s, long long interval_ns);
+void sched_started(struct scheduler *s, const struct timespec *start);
+void sched_sleep(const struct timespec *until);
+int sched_timeout_ms(const struct timespec *until);
+
+#endif
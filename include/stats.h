@@ -0,0 +1,81 @@
+/**
+ * stats.h
+ *
+ * Toke Høiland-Jørgensen
+ * 2026-10-17
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "transfer.h"
+
+/* Per-request phase durations derived from the cumulative cURL times. */
+enum {
+	PHASE_DNS,
+	PHASE_CONNECT,
+	PHASE_TLS,
+	PHASE_SERVER,
+	PHASE_TRANSFER,
+	NUM_PHASES
+};
+
+/* Log-linear (HDR-style) histogram of microsecond values: exact below
+ * HIST_SUB_BUCKETS, and HIST_SUB_BUCKETS/2 linear buckets per power of two
+ * above that, giving better than 1.6% relative precision up to
+ * 2^HIST_MAX_BITS us (about 12 days). Recording is constant time. */
+#define HIST_SUB_BITS 7
+#define HIST_SUB_BUCKETS (1 << HIST_SUB_BITS)
+#define HIST_MAX_BITS 40
+#define HIST_NBUCKETS(sub_bits) ((1 << (sub_bits)) + (HIST_MAX_BITS - (sub_bits)) * (1 << ((sub_bits) - 1)))
+#define HIST_BUCKETS HIST_NBUCKETS(HIST_SUB_BITS)
+
+struct histogram {
+	uint64_t count;
+	uint64_t max;
+	uint64_t counts[HIST_BUCKETS];
+};
+
+/* Compact variant for tables with one histogram per URL: 8 linear buckets per
+ * power of two (better than 12.5% relative precision) and 32-bit counts, for
+ * about 1 KiB each. */
+#define CHIST_SUB_BITS 4
+#define CHIST_BUCKETS HIST_NBUCKETS(CHIST_SUB_BITS)
+
+struct compact_histogram {
+	uint32_t count;
+	uint32_t counts[CHIST_BUCKETS];
+	uint64_t max;
+};
+
+struct cycle_stats {
+	int requests;
+	int errors;
+	int missed;
+	int hedged;
+	int hedge_wins;
+	long bytes;
+	long connects;
+	curl_off_t phase_sum[NUM_PHASES];
+	curl_off_t phase_max[NUM_PHASES];
+	struct histogram *request_hist;
+};
+
+void hist_reset(struct histogram *h);
+void hist_record(struct histogram *h, uint64_t value);
+void hist_merge(struct histogram *dst, const struct histogram *src);
+uint64_t hist_percentile(const struct histogram *h, double percentile);
+void hist_print(FILE *output, const char *name, const struct histogram *h);
+int chist_index(uint64_t value);
+void chist_record(struct compact_histogram *h, uint64_t value);
+uint64_t chist_percentile(const struct compact_histogram *h, double percentile);
+
+void result_phases(const struct result *r, curl_off_t *phases);
+void cycle_stats_reset(struct cycle_stats *cs, struct histogram *request_hist);
+void cycle_stats_add(struct cycle_stats *cs, const struct result *r);
+void cycle_stats_merge(struct cycle_stats *dst, const struct cycle_stats *src);
+void print_cycle_timings(FILE *output, const struct cycle_stats *cs);
+
+#endif
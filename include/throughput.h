@@ -0,0 +1,39 @@
+/**
+ * throughput.h
+ *
+ * Toke Høiland-Jørgensen
+ * 2026-10-17
+ */
+
+#ifndef THROUGHPUT_H
+#define THROUGHPUT_H
+
+#include <stdio.h>
+
+struct result;
+
+/* Goodput sampling inside transfers (-g): cURL's progress callback samples
+ * the body bytes received so far at most once per interval, into a buffer set
+ * up once per handle. When the buffer fills up, every other sample is dropped
+ * and the interval doubled, so a transfer of any length fits. From the samples
+ * each result gets the goodput curve since the first byte (see transfer.h),
+ * its peak goodput, the time it took to ramp up to RAMP_FRACTION of its
+ * steady goodput (that over the second half of the body), and its stalls:
+ * gaps of at least STALL_INTERVALS intervals without a new byte. */
+#define THROUGHPUT_SAMPLES 1024
+#define RAMP_FRACTION 0.9
+#define RAMP_MIN_SAMPLES 4
+#define STALL_INTERVALS 5
+
+struct throughput;
+
+struct throughput *throughput_new(int interval_ms);
+void throughput_free(struct throughput *tp);
+void throughput_reset(struct throughput *tp);
+void throughput_update(struct throughput *tp, long bytes);
+void throughput_result(struct throughput *tp, struct result *r);
+void throughput_stats_init(int interval_ms);
+void throughput_stats_add(const struct result *r);
+void throughput_stats_print(FILE *output);
+
+#endif
@@ -0,0 +1,64 @@
+/**
+ * trace.h
+ *
+ * Toke Høiland-Jørgensen
+ * 2026-10-17
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+#include "transfer.h"
+
+/* A trace is a header followed by fixed-size entries, in host byte order, one
+ * per request: when it was dispatched (nanoseconds from the start of the run),
+ * the index of its URL in the URL file, the worker (or connection slot, or
+ * thread) that ran it, and how it went. Entries are written as requests
+ * complete, so they are only roughly in dispatch order; a trace converted
+ * from an access log need not be in order at all. */
+#define TRACE_MAGIC 0x52544748 /* "HGTR" */
+#define TRACE_VERSION 1
+
+struct trace_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t entry_size;
+	uint32_t pad;
+	int64_t start;
+};
+
+struct trace_entry {
+	int64_t offset_ns;
+	int32_t url;
+	int16_t worker;
+	int16_t status;
+	int16_t code;
+	int16_t pad;
+	uint32_t duration_us;
+};
+
+/* A mapped trace. If the entries are out of order, order holds their indexes
+ * in dispatch order. */
+struct trace {
+	const struct trace_entry *entries;
+	uint32_t *order;
+	size_t count;
+	void *map;
+	size_t map_len;
+};
+
+static inline const struct trace_entry *trace_get(const struct trace *t, size_t i)
+{
+	return &t->entries[t->order ? t->order[i] : i];
+}
+
+int trace_record_open(const char *path);
+void trace_record(const struct result *r, const struct timespec *start);
+void trace_record_close();
+int trace_map(struct trace *t, const char *path);
+void trace_unmap(struct trace *t);
+
+#endif
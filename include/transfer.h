@@ -0,0 +1,103 @@
+/**
+ * transfer.h
+ *
+ * Toke Høiland-Jørgensen
+ * 2026-10-17
+ */
+
+#ifndef TRANSFER_H
+#define TRANSFER_H
+
+#include <stdint.h>
+#include <curl/curl.h>
+#include "options.h"
+
+/* Per-transfer state for the write callback. When urls is set, the body is
+ * a URL list and is parsed into it as it streams in; otherwise the body is
+ * discarded, after being hashed into digest (CRC32C) if verify is set. With
+ * content encodings asked for, the body is decoded (by dec) first. With
+ * goodput sampling, tp follows the progress of the body. The engines call
+ * transfer_start() before each transfer on a handle, and pick up what the
+ * write and progress callbacks found with transfer_result(). An engine that
+ * needs to abort transfers sets cancelled before calling setup_handle(); the
+ * progress callback aborts the transfer when it returns non-zero. */
+struct transfer_data {
+	CURL *curl;
+	struct url_table *urls;
+	int verify;
+	uint32_t digest;
+	struct decoder *dec;
+	struct throughput *tp;
+	int (*cancelled)(void *ctx);
+	void *cancel_ctx;
+};
+
+/* Cumulative transfer times as reported by cURL, in microseconds. */
+enum {
+	TIME_NAMELOOKUP,
+	TIME_CONNECT,
+	TIME_APPCONNECT,
+	TIME_STARTTRANSFER,
+	TIME_TOTAL,
+	NUM_TIMES
+};
+
+/* Whether a request was hedged (duplicated on another worker or connection
+ * because it was slow), and if so, which of the two copies finished first. */
+#define HEDGE_NONE 0
+#define HEDGE_LOST 1
+#define HEDGE_WON 2
+
+/* The goodput curve of a transfer (see throughput.h) is the body bytes that
+ * came in during each of a number of windows since its first byte: the first
+ * one sampling interval long, and each one after that twice as long as the one
+ * before, the last one lasting until the end of the transfer. */
+#define CURVE_WINDOWS 16
+
+/* The engine fills in which of its workers (or connection slots, or threads)
+ * ran a request, and when it was first dispatched; for a hedged request, that
+ * is when the original copy was. The digest of the body is only set when
+ * verifying, and is checked (setting verify) as the result comes in. The
+ * encoding, the bytes of the body on the wire and decoded, and the CPU time
+ * spent decoding it are only set when asking for content encodings, and the
+ * goodput fields when sampling it; ramp_ns is -1 if there were too few
+ * samples to tell, and peak_rate is in bytes per second. */
+struct result {
+	int url;
+	int status;
+	int hedge;
+	int worker;
+	long code;
+	long bytes;
+	long connects;
+	uint32_t digest;
+	int verify;
+	int encoding;
+	long wire_bytes;
+	long decoded_bytes;
+	long long decode_ns;
+	int samples;
+	int stalls;
+	long long body_ns;
+	long long ramp_ns;
+	long long stall_ns;
+	long peak_rate;
+	long curve[CURVE_WINDOWS];
+	curl_off_t times[NUM_TIMES];
+	struct timespec started;
+};
+
+size_t write_callback(void *contents, size_t size, size_t nmemb, void *userp);
+int setup_handle(CURL *curl, struct options *opt, struct transfer_data *td);
+void transfer_start(struct transfer_data *td);
+int transfer_result(struct transfer_data *td, struct result *r);
+void transfer_data_destroy(struct transfer_data *td);
+void destroy_share();
+void set_transfer_timeout(CURL *curl, struct options *opt, long left_ms);
+int get_result(CURL *curl, struct result *r);
+void result_init(struct result *r);
+void result_delay(struct result *r, curl_off_t us);
+struct curl_slist *list_request_headers(const char *etag, const char *last_modified);
+long get_list_validators(CURL *curl, const char **etag, const char **last_modified);
+
+#endif
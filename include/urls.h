@@ -0,0 +1,62 @@
+/**
+ * urls.h
+ *
+ * Toke Høiland-Jørgensen
+ * 2026-10-17
+ */
+
+#ifndef URLS_H
+#define URLS_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+/* URL list stored as NUL-terminated strings packed into a single growable
+ * arena, with an index of offsets into it. While a list is being streamed in,
+ * the incomplete last line is kept (pending bytes) at the end of the arena. */
+struct url_table {
+	char *arena;
+	size_t arena_len;
+	size_t arena_size;
+	size_t pending;
+	size_t *offsets;
+	size_t count;
+	size_t size;
+};
+
+static inline const char *url_get(const struct url_table *t, size_t i)
+{
+	return t->arena + t->offsets[i];
+}
+
+struct url_list;
+
+/* The newest URL table that per-URL state is kept for, as seen by the cycle
+ * that brought it: a cycle that still runs on an older table (from an older
+ * fetched list) does not switch back to it. A fetched list is held on to, so
+ * that its table cannot be freed and another allocated in its place. */
+struct table_ref {
+	const struct url_table *table;
+	struct url_list *list;
+	int cycle;
+};
+
+#define TABLE_REF_INIT { .table = NULL, .list = NULL, .cycle = -1 }
+
+void url_table_init(struct url_table *t);
+void url_table_destroy(struct url_table *t);
+void url_table_reset(struct url_table *t);
+struct url_table *url_table_new();
+void url_table_free(struct url_table *t);
+int url_table_add(struct url_table *t, const char *url, size_t len);
+int url_table_feed(struct url_table *t, const char *buf, size_t len);
+int url_table_finish(struct url_table *t);
+int url_table_parse(struct url_table *t, const char *buf, size_t len);
+int url_table_adopt(struct url_table *t, char *arena, size_t len, size_t size);
+int url_table_load(struct url_table *t, FILE *f);
+char *url_table_fields(struct url_table *t, size_t i);
+int table_ref_newer(const struct table_ref *ref, const struct url_table *t, int cycle);
+void table_ref_set(struct table_ref *ref, const struct url_table *t, struct url_list *l, int cycle);
+void table_ref_clear(struct table_ref *ref);
+
+#endif
@@ -0,0 +1,33 @@
+/**
+ * urlstats.h
+ *
+ * Toke Høiland-Jørgensen
+ * 2026-10-17
+ */
+
+#ifndef URLSTATS_H
+#define URLSTATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "cycle.h"
+#include "stats.h"
+#include "transfer.h"
+
+/* Totals for one URL or host over the whole run. Requests are the successful
+ * ones, and only they go into the histogram of total request times (in
+ * microseconds). */
+struct url_stats {
+	uint32_t requests;
+	uint32_t errors;
+	uint64_t bytes;
+	uint64_t time_sum;
+	struct compact_histogram hist;
+};
+
+void url_stats_add(const struct cycle *c, const struct result *r);
+void url_stats_print(FILE *output);
+void url_stats_output();
+void url_stats_destroy();
+
+#endif
@@ -18,7 +18,30 @@
        __typeof__ (b) _b = (b); \
      _a > _b ? _a : _b; })
 
+#include <time.h>
+#include <stddef.h>
+
+#define NSEC_PER_SEC 1000000000L
+
+static inline void ts_add_ns(struct timespec *ts, long long ns)
+{
+	ns += ts->tv_nsec;
+	ts->tv_sec += ns / NSEC_PER_SEC;
+	ts->tv_nsec = ns % NSEC_PER_SEC;
+	if(ts->tv_nsec < 0) {
+		ts->tv_nsec += NSEC_PER_SEC;
+		ts->tv_sec--;
+	}
+}
+
+/* Difference a - b in nanoseconds. */
+static inline long long ts_diff_ns(const struct timespec *a, const struct timespec *b)
+{
+	return (long long)(a->tv_sec - b->tv_sec) * NSEC_PER_SEC + (a->tv_nsec - b->tv_nsec);
+}
+
 int msg_write(int fd, char* buf, int len);
 int msg_read(int fd, char* buf, int len);
+int msg_read_alloc(int fd, char **buf, size_t *size);
 
 #endif
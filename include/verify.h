@@ -0,0 +1,32 @@
+/**
+ * verify.h
+ *
+ * Toke Høiland-Jørgensen
+ * 2026-10-17
+ */
+
+#ifndef VERIFY_H
+#define VERIFY_H
+
+#include <stdio.h>
+#include "cycle.h"
+#include "transfer.h"
+
+/* Body verification: the engines hash every body as it streams in (see
+ * transfer.h), and each hash is checked against the one given for its URL in
+ * the URL list, as a crc32c=<hex> field after the URL, or otherwise against
+ * the one seen for the URL the last time. A body that could not be checked
+ * (the first one of a URL without a given hash, or a failed transfer) is left
+ * at VERIFY_NONE. */
+#define VERIFY_NONE 0
+#define VERIFY_OK 1
+#define VERIFY_MISMATCH 2
+#define VERIFY_CHANGED 3
+
+int verify_init(struct url_table *urls);
+void verify_cycle(struct cycle *c);
+void verify_result(const struct cycle *c, struct result *r);
+void verify_print(FILE *output);
+void verify_destroy();
+
+#endif
@@ -9,17 +9,35 @@
 #define WORKER_H
 #define _GNU_SOURCE             /* See feature_test_macros(7) */
 #include <fcntl.h>              /* Obtain O_* constant definitions */
+#include <stdint.h>
 #include <unistd.h>
 #include "options.h"
+#include "cycle.h"
 
 #define STATUS_READY 0
 #define STATUS_WORKING 1
+#define STATUS_CANCELLED 2
 
+/* A hedged request runs on two workers at once, linked through twin until
+ * one of them finishes. hedge is set on the duplicate, and hedged on both. */
 struct worker {
 	struct worker *next;
-	char *url;
+	int id;
+	const char *url;
+	int url_idx;
+	struct cycle *cycle;
+	int cycle_id;
 	int status;
 	int pid;
+	uint32_t seq;
+	unsigned int resolve_gen;
+	struct timespec started;
+	struct timespec issued;
+	struct worker *twin;
+	int hedge;
+	int hedged;
+	struct result_ring *ring;
+	int efd;
 	int pipe_r;
 	int pipe_w;
 };
@@ -0,0 +1,58 @@
+/**
+ * adaptive.c
+ *
+ * Toke Høiland-Jørgensen
+ * 2026-10-17
+ *
+ * The controller assumes that, below saturation, the cycle time is inversely
+ * and the request rate directly proportional to the concurrency. Each step
+ * scales the concurrency by the square root of the error ratio, which damps
+ * the response to noisy cycles, and by no more than a factor of two. Within
+ * the dead band around the target, the concurrency is left alone.
+ */
+
+#include <math.h>
+#include "adaptive.h"
+#include "util.h"
+
+#define ADAPT_START 4
+#define ADAPT_DEAD_BAND 0.05
+#define ADAPT_MAX_STEP 2.0
+
+void adaptive_init(struct adaptive *a, int mode, double target, int max)
+{
+	a->mode = mode;
+	a->target = target;
+	a->max = max;
+	a->current = a->low = a->high = min(ADAPT_START, max);
+}
+
+/* Feed in a completed cycle, and return the concurrency for the next one. The
+ * target is in milliseconds or requests per second. */
+int adaptive_update(struct adaptive *a, int requests, long long duration_ns)
+{
+	double measured, ratio;
+	int next;
+
+	if(a->mode == ADAPT_NONE || duration_ns <= 0)
+		return a->current;
+	if(a->mode == ADAPT_CYCLE_TIME) {
+		measured = duration_ns / 1e6;
+		ratio = measured / a->target;
+	} else {
+		measured = requests / (duration_ns / 1e9);
+		ratio = measured > 0 ? a->target / measured : ADAPT_MAX_STEP;
+	}
+	if(fabs(ratio - 1) < ADAPT_DEAD_BAND)
+		return a->current;
+
+	ratio = fmin(fmax(sqrt(ratio), 1 / ADAPT_MAX_STEP), ADAPT_MAX_STEP);
+	next = lround(a->current * ratio);
+	/* Always move by at least one in the direction of the error. */
+	if(next == a->current)
+		next += ratio > 1 ? 1 : -1;
+	a->current = max(1, min(next, a->max));
+	a->low = min(a->low, a->current);
+	a->high = max(a->high, a->current);
+	return a->current;
+}
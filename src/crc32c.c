@@ -0,0 +1,97 @@
+/**
+ * crc32c.c
+ *
+ * Toke Høiland-Jørgensen
+ * 2026-10-17
+ *
+ * CRC32C, with the CPU's CRC instruction where there is one (SSE 4.2 on
+ * x86-64, checked at run time; the CRC extension on ARMv8, if built for it),
+ * which takes 8 bytes at a time at several gigabytes per second. Otherwise it
+ * is slicing-by-8 over tables built at startup.
+ */
+
+#include <string.h>
+#include "crc32c.h"
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
+#define CRC32C_POLY 0x82f63b78
+
+static uint32_t table[8][256];
+static uint32_t (*update)(uint32_t crc, const unsigned char *p, size_t len) = NULL;
+
+static uint32_t update_sw(uint32_t crc, const unsigned char *p, size_t len)
+{
+	for(; len >= 8; p += 8, len -= 8) {
+		crc ^= p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+		crc = table[7][crc & 0xff] ^ table[6][(crc >> 8) & 0xff] ^
+			table[5][(crc >> 16) & 0xff] ^ table[4][crc >> 24] ^
+			table[3][p[4]] ^ table[2][p[5]] ^ table[1][p[6]] ^ table[0][p[7]];
+	}
+	for(; len; p++, len--)
+		crc = table[0][(crc ^ *p) & 0xff] ^ (crc >> 8);
+	return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t update_hw(uint32_t crc, const unsigned char *p, size_t len)
+{
+	uint64_t c = crc, v;
+	for(; len >= 8; p += 8, len -= 8) {
+		memcpy(&v, p, sizeof(v));
+		c = _mm_crc32_u64(c, v);
+	}
+	crc = c;
+	for(; len; p++, len--)
+		crc = _mm_crc32_u8(crc, *p);
+	return crc;
+}
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+static uint32_t update_hw(uint32_t crc, const unsigned char *p, size_t len)
+{
+	uint64_t v;
+	for(; len >= 8; p += 8, len -= 8) {
+		memcpy(&v, p, sizeof(v));
+		crc = __crc32cd(crc, v);
+	}
+	for(; len; p++, len--)
+		crc = __crc32cb(crc, *p);
+	return crc;
+}
+#endif
+
+void crc32c_init()
+{
+	uint32_t c;
+	int i, j;
+
+	if(update)
+		return;
+	for(i = 0; i < 256; i++) {
+		c = i;
+		for(j = 0; j < 8; j++)
+			c = c & 1 ? (c >> 1) ^ CRC32C_POLY : c >> 1;
+		table[0][i] = c;
+	}
+	for(i = 0; i < 256; i++) {
+		for(j = 1; j < 8; j++)
+			table[j][i] = (table[j-1][i] >> 8) ^ table[0][table[j-1][i] & 0xff];
+	}
+	update = update_sw;
+#if defined(__x86_64__)
+	if(__builtin_cpu_supports("sse4.2"))
+		update = update_hw;
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+	update = update_hw;
+#endif
+}
+
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len)
+{
+	return ~update(~crc, buf, len);
+}
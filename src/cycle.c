@@ -0,0 +1,286 @@
+/**
+ * cycle.c
+ *
+ * Toke Høiland-Jørgensen
+ * 2026-10-17
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "cycle.h"
+#include "util.h"
+
+static size_t cycle_urls(struct cycle *c)
+{
+	if(c->indexes)
+		return c->nindexes;
+	return c->urls ? c->urls->count : 0;
+}
+
+static struct cycle *cycles = NULL;
+static void (*cycle_request_done)(const struct cycle *c, const struct result *r) = NULL;
+static void (*cycle_done)(struct cycle *c) = NULL;
+static void (*cycle_pick)(struct cycle *c) = NULL;
+
+/* Pick, if set, chooses the URLs of a cycle as soon as its URL table is
+ * known. */
+void cycles_init(void (*request_done)(const struct cycle *c, const struct result *r),
+		 void (*done)(struct cycle *c), void (*pick)(struct cycle *c))
+{
+	cycle_request_done = request_done;
+	cycle_done = done;
+	cycle_pick = pick;
+}
+
+struct cycle *cycle_new(int id, struct url_table *urls, char *urls_loc)
+{
+	struct cycle *c = calloc(1, sizeof(*c));
+	if(!c) {
+		perror("calloc");
+		return NULL;
+	}
+	c->id = id;
+	c->urls = urls;
+	c->urls_loc = urls_loc;
+	c->list_state = urls_loc ? LIST_PENDING : LIST_NONE;
+	if(urls_loc && (c->list = list_cache_get())) {
+		c->urls = &c->list->urls;
+		c->list_state = LIST_NONE;
+		c->list_status = LIST_CACHED;
+	}
+	return c;
+}
+
+static int cycle_complete(struct cycle *c)
+{
+	return c->list_state == LIST_NONE && c->active == 0 && c->cururl >= cycle_urls(c);
+}
+
+static void cycle_finish(struct cycle *c)
+{
+	struct cycle **p;
+	for(p = &cycles; *p; p = &(*p)->next) {
+		if(*p == c) {
+			*p = c->next;
+			break;
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &c->end);
+	if(cycle_done)
+		cycle_done(c);
+	else
+		cycle_free(c);
+}
+
+/* Add a cycle to the tail of the queue of cycles in flight. */
+void cycle_start(struct cycle *c)
+{
+	struct cycle **p;
+	for(p = &cycles; *p; p = &(*p)->next);
+	c->next = NULL;
+	*p = c;
+	if(cycle_pick && c->list_state == LIST_NONE)
+		cycle_pick(c);
+	if(cycle_complete(c))
+		cycle_finish(c);
+}
+
+int cycles_running()
+{
+	return cycles != NULL;
+}
+
+static int has_deadline(const struct timespec *deadline)
+{
+	return deadline->tv_sec || deadline->tv_nsec;
+}
+
+int deadline_passed(const struct timespec *deadline)
+{
+	struct timespec now;
+	if(!has_deadline(deadline))
+		return 0;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return ts_diff_ns(&now, deadline) >= 0;
+}
+
+/* Whether a transfer failed because it ran into the deadline: the engines
+ * bound every transfer by the time left until it, so it times out. Any other
+ * failure is an error, deadline or not. */
+int deadline_missed(const struct timespec *deadline, int status)
+{
+	return status == CURLE_OPERATION_TIMEDOUT && deadline_passed(deadline);
+}
+
+/* Time left until a deadline in milliseconds, for use as a transfer timeout:
+ * rounded up, so a transfer limited to it does not give up before the
+ * deadline has passed, and at least 1. 0 if there is no deadline. */
+long deadline_left_ms(const struct timespec *deadline)
+{
+	struct timespec now;
+	long long ns;
+	if(!has_deadline(deadline))
+		return 0;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ns = ts_diff_ns(deadline, &now);
+	return ns <= 0 ? 1 : (ns + 999999) / 1000000;
+}
+
+/* The earliest deadline of the cycles that have not expired yet, or NULL.
+ * Cycles are queued in start order, so their deadlines are in order too. */
+const struct timespec *cycles_next_deadline()
+{
+	struct cycle *cur;
+	for(cur = cycles; cur; cur = cur->next) {
+		if(!cur->expired && has_deadline(&cur->deadline))
+			return &cur->deadline;
+	}
+	return NULL;
+}
+
+/* Stop handing out work for a cycle that has run out of time, and count what
+ * was never dispatched as missed. The transfers still in flight are bounded
+ * by the deadline as well, and are counted as they come back. */
+static void cycle_expire(struct cycle *c)
+{
+	c->expired = 1;
+	if(c->list_state == LIST_PENDING) {
+		c->list_state = LIST_NONE;
+		c->stats.missed++;
+	}
+	if(c->list_state == LIST_NONE && c->cururl < cycle_urls(c)) {
+		c->stats.missed += cycle_urls(c) - c->cururl;
+		c->cururl = cycle_urls(c);
+	}
+	if(cycle_complete(c))
+		cycle_finish(c);
+}
+
+void cycles_expire()
+{
+	struct cycle *cur, *next;
+	for(cur = cycles; cur; cur = next) {
+		next = cur->next;
+		if(!cur->expired && deadline_passed(&cur->deadline))
+			cycle_expire(cur);
+	}
+}
+
+/* Hand out the next piece of work: the URL list fetch of a cycle (*url set to
+ * -1), or the index of the next URL to get. Returns 0 when there is nothing
+ * left to dispatch right now. */
+int cycle_take(struct cycle **c, int *url)
+{
+	struct cycle *cur;
+	for(cur = cycles; cur; cur = cur->next) {
+		if(cur->list_state == LIST_PENDING) {
+			cur->list_state = LIST_FETCHING;
+			cur->active++;
+			*c = cur;
+			*url = -1;
+			return 1;
+		}
+		if(cur->list_state == LIST_NONE && cur->cururl < cycle_urls(cur)) {
+			cur->active++;
+			*c = cur;
+			*url = cycle_url(cur, cur->cururl++);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* Like cycle_take(), but hand out all the remaining URLs of a cycle at once, as
+ * the *count positions starting at *url (see cycle_url()). */
+int cycle_take_batch(struct cycle **c, int *url, int *count)
+{
+	struct cycle *cur;
+	for(cur = cycles; cur; cur = cur->next) {
+		if(cur->list_state == LIST_PENDING) {
+			cur->list_state = LIST_FETCHING;
+			cur->active++;
+			*c = cur;
+			*url = -1;
+			*count = 1;
+			return 1;
+		}
+		if(cur->list_state == LIST_NONE && cur->cururl < cycle_urls(cur)) {
+			*c = cur;
+			*url = cur->cururl;
+			*count = cycle_urls(cur) - cur->cururl;
+			cur->active += *count;
+			cur->cururl += *count;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* Install the URL list fetched for this cycle; the cycle takes over the
+ * reference. */
+void cycle_set_list(struct cycle *c, struct url_list *list, int status)
+{
+	c->list = list;
+	c->urls = list ? &list->urls : NULL;
+	c->list_status = status;
+	c->cururl = 0;
+	if(cycle_pick)
+		cycle_pick(c);
+	if(c->expired) {
+		c->stats.missed += cycle_urls(c);
+		c->cururl = cycle_urls(c);
+	}
+}
+
+void cycle_add_result(struct cycle *c, struct result *r)
+{
+	/* A transfer that failed because it ran into the deadline is a
+	 * miss, not an error. */
+	int missed = deadline_missed(&c->deadline, r->status);
+
+	if(missed)
+		c->stats.missed++;
+	else if(r->status)
+		c->err = r->status;
+	if(cycle_request_done)
+		cycle_request_done(c, r);
+
+	/* The list fetch is accounted separately from the content requests. */
+	if(r->url == -1) {
+		c->list_state = LIST_NONE;
+		c->list_time = r->times[TIME_TOTAL];
+		clock_gettime(CLOCK_MONOTONIC, &c->list_done);
+	} else if(!missed) {
+		if(!r->status)
+			c->bytes += r->bytes;
+		cycle_stats_add(&c->stats, r);
+	}
+	c->active--;
+	if(cycle_complete(c))
+		cycle_finish(c);
+}
+
+/* Account for n requests of a cycle at once, from statistics that were
+ * collected elsewhere. The individual results, if given, are only passed on to
+ * the request callback. */
+void cycle_add_batch(struct cycle *c, const struct cycle_stats *cs, int err,
+		     const struct result *results, int n)
+{
+	int i;
+	if(err)
+		c->err = err;
+	for(i = 0; results && cycle_request_done && i < n; i++)
+		cycle_request_done(c, &results[i]);
+	c->bytes += cs->bytes;
+	cycle_stats_merge(&c->stats, cs);
+	c->active -= n;
+	if(cycle_complete(c))
+		cycle_finish(c);
+}
+
+void cycle_free(struct cycle *c)
+{
+	url_list_put(c->list);
+	free(c->indexes);
+	free(c);
+}
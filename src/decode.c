@@ -0,0 +1,413 @@
+/**
+ * decode.c
+ *
+ * Toke Høiland-Jørgensen
+ * 2026-10-17
+ *
+ * Streaming content decoding. Each transfer handle has a decoder, whose state
+ * (and output buffer) is set up once and reset between transfers, so memory
+ * stays constant however large the bodies are; the decoded data goes straight
+ * on to the sink and is not kept. Only the decompression calls themselves are
+ * timed, on the CPU clock of the thread doing them.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_BROTLI
+#include <brotli/decode.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#include "decode.h"
+#include "transfer.h"
+#include "util.h"
+
+#define DECODE_BUFSIZE 16384
+
+struct decoder {
+	int started;
+	int encoding;
+	int done;
+	long wire_bytes;
+	long decoded_bytes;
+	long long decode_ns;
+#ifdef HAVE_ZLIB
+	z_stream z;
+	int z_init;
+	int z_raw;
+#endif
+#ifdef HAVE_BROTLI
+	BrotliDecoderState *br;
+#endif
+#ifdef HAVE_ZSTD
+	ZSTD_DStream *zstd;
+#endif
+	unsigned char out[DECODE_BUFSIZE];
+};
+
+struct decode_stats {
+	int responses;
+	long wire_bytes;
+	long decoded_bytes;
+	long long decode_ns;
+};
+
+static const char *encoding_names[NUM_ENCODINGS] = {
+	[ENCODING_IDENTITY] = "identity",
+	[ENCODING_GZIP] = "gzip",
+	[ENCODING_DEFLATE] = "deflate",
+	[ENCODING_BROTLI] = "br",
+	[ENCODING_ZSTD] = "zstd",
+	[ENCODING_OTHER] = "other",
+};
+
+static struct decode_stats totals[NUM_ENCODINGS];
+
+const char *encoding_name(int encoding)
+{
+	return encoding_names[encoding];
+}
+
+static int encoding_supported(int encoding)
+{
+	switch(encoding) {
+	case ENCODING_IDENTITY:
+		return 1;
+#ifdef HAVE_ZLIB
+	case ENCODING_GZIP:
+	case ENCODING_DEFLATE:
+		return 1;
+#endif
+#ifdef HAVE_BROTLI
+	case ENCODING_BROTLI:
+		return 1;
+#endif
+#ifdef HAVE_ZSTD
+	case ENCODING_ZSTD:
+		return 1;
+#endif
+	}
+	return 0;
+}
+
+/* The Accept-Encoding value for a comma-separated list of encodings, or for
+ * "all" of the ones this build can decode. */
+char *encodings_accept(const char *list)
+{
+	char *copy, *s, *save, buf[64] = "";
+	int e, all = !strcmp(list, "all"), want[NUM_ENCODINGS] = {0};
+
+	if(!(copy = strdup(list))) {
+		perror("strdup");
+		return NULL;
+	}
+	for(s = strtok_r(copy, ",", &save); s && !all; s = strtok_r(NULL, ",", &save)) {
+		for(e = 0; e < ENCODING_OTHER && strcmp(s, encoding_names[e]); e++);
+		if(e == ENCODING_OTHER || !encoding_supported(e)) {
+			fprintf(stderr, "Unsupported content encoding: %s\n", s);
+			free(copy);
+			return NULL;
+		}
+		want[e] = 1;
+	}
+	free(copy);
+	for(e = 0; e < ENCODING_OTHER; e++) {
+		if(all ? e != ENCODING_IDENTITY && encoding_supported(e) : want[e]) {
+			if(*buf)
+				strcat(buf, ", ");
+			strcat(buf, encoding_names[e]);
+		}
+	}
+	if(!*buf) {
+		fprintf(stderr, "No content encodings to ask for.\n");
+		return NULL;
+	}
+	return strdup(buf);
+}
+
+/* A Content-Encoding value. More than one encoding, one way on top of the
+ * other, is passed through undecoded. */
+static int encoding_lookup(const char *value)
+{
+	size_t len;
+	int e;
+
+	value += strspn(value, " \t");
+	len = strcspn(value, " \t,");
+	if(value[len + strspn(value + len, " \t")] == ',')
+		return ENCODING_OTHER;
+	if(!len)
+		return ENCODING_IDENTITY;
+	if(len == 6 && !strncasecmp(value, "x-gzip", len))
+		return ENCODING_GZIP;
+	for(e = 0; e < ENCODING_OTHER; e++) {
+		if(strlen(encoding_names[e]) == len && !strncasecmp(value, encoding_names[e], len))
+			return encoding_supported(e) ? e : ENCODING_OTHER;
+	}
+	return ENCODING_OTHER;
+}
+
+static long long cpu_ns()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+	return (long long)now.tv_sec * NSEC_PER_SEC + now.tv_nsec;
+}
+
+struct decoder *decoder_new()
+{
+	struct decoder *d = calloc(1, sizeof(*d));
+	if(!d)
+		perror("calloc");
+	return d;
+}
+
+void decoder_free(struct decoder *d)
+{
+	if(!d)
+		return;
+#ifdef HAVE_ZLIB
+	if(d->z_init)
+		inflateEnd(&d->z);
+#endif
+#ifdef HAVE_BROTLI
+	if(d->br)
+		BrotliDecoderDestroyInstance(d->br);
+#endif
+#ifdef HAVE_ZSTD
+	ZSTD_freeDStream(d->zstd);
+#endif
+	free(d);
+}
+
+void decoder_reset(struct decoder *d)
+{
+	d->started = 0;
+	d->encoding = ENCODING_IDENTITY;
+	d->done = 0;
+	d->wire_bytes = 0;
+	d->decoded_bytes = 0;
+	d->decode_ns = 0;
+}
+
+int decoder_started(const struct decoder *d)
+{
+	return d->started;
+}
+
+/* Set up for a body in the given Content-Encoding (NULL if none). */
+int decoder_start(struct decoder *d, const char *content_encoding)
+{
+	d->started = 1;
+	d->encoding = content_encoding ? encoding_lookup(content_encoding) : ENCODING_IDENTITY;
+	switch(d->encoding) {
+#ifdef HAVE_ZLIB
+	case ENCODING_GZIP:
+	case ENCODING_DEFLATE:
+		/* Either a gzip or a zlib header; a raw deflate stream is
+		 * only noticed once its first bytes fail to parse as one. */
+		d->z_raw = 0;
+		if(d->z_init)
+			return inflateReset2(&d->z, 15 + 32) == Z_OK ? 0 : -1;
+		if(inflateInit2(&d->z, 15 + 32) != Z_OK)
+			return -1;
+		d->z_init = 1;
+		break;
+#endif
+#ifdef HAVE_BROTLI
+	case ENCODING_BROTLI:
+		if(d->br)
+			BrotliDecoderDestroyInstance(d->br);
+		if(!(d->br = BrotliDecoderCreateInstance(NULL, NULL, NULL)))
+			return -1;
+		break;
+#endif
+#ifdef HAVE_ZSTD
+	case ENCODING_ZSTD:
+		if(!d->zstd && !(d->zstd = ZSTD_createDStream()))
+			return -1;
+		if(ZSTD_isError(ZSTD_initDStream(d->zstd)))
+			return -1;
+		break;
+#endif
+	}
+	return 0;
+}
+
+static int decode_error(struct decoder *d)
+{
+	fprintf(stderr, "Unable to decode %s content.\n", encoding_names[d->encoding]);
+	return -1;
+}
+
+static int emit(struct decoder *d, decode_sink sink, void *ctx, size_t len)
+{
+	d->decoded_bytes += len;
+	return len ? sink(ctx, d->out, len) : 0;
+}
+
+#ifdef HAVE_ZLIB
+static int decode_zlib(struct decoder *d, const void *buf, size_t len, decode_sink sink, void *ctx)
+{
+	uLong total_in = d->z.total_in;
+	long long start;
+	int err;
+
+	d->z.next_in = (Bytef *)buf;
+	d->z.avail_in = len;
+	do {
+		d->z.next_out = d->out;
+		d->z.avail_out = sizeof(d->out);
+		start = cpu_ns();
+		err = inflate(&d->z, Z_NO_FLUSH);
+		/* Some servers send "deflate" without the zlib header, as
+		 * raw deflate data: start over on this chunk that way if
+		 * the header is where it failed. */
+		if(err == Z_DATA_ERROR && d->encoding == ENCODING_DEFLATE && !d->z_raw &&
+		   !total_in && !d->z.total_out && inflateReset2(&d->z, -MAX_WBITS) == Z_OK) {
+			d->z_raw = 1;
+			d->z.next_in = (Bytef *)buf;
+			d->z.avail_in = len;
+			err = inflate(&d->z, Z_NO_FLUSH);
+		}
+		d->decode_ns += cpu_ns() - start;
+		if(err != Z_OK && err != Z_STREAM_END && err != Z_BUF_ERROR)
+			return decode_error(d);
+		if(emit(d, sink, ctx, sizeof(d->out) - d->z.avail_out))
+			return -1;
+		d->done = err == Z_STREAM_END;
+	} while(!d->done && err != Z_BUF_ERROR && (d->z.avail_in || !d->z.avail_out));
+	return 0;
+}
+#endif
+
+#ifdef HAVE_BROTLI
+static int decode_brotli(struct decoder *d, const void *buf, size_t len, decode_sink sink, void *ctx)
+{
+	BrotliDecoderResult res;
+	const uint8_t *next_in = buf;
+	uint8_t *next_out;
+	size_t avail_out;
+	long long start;
+
+	do {
+		next_out = d->out;
+		avail_out = sizeof(d->out);
+		start = cpu_ns();
+		res = BrotliDecoderDecompressStream(d->br, &len, &next_in, &avail_out, &next_out, NULL);
+		d->decode_ns += cpu_ns() - start;
+		if(res == BROTLI_DECODER_RESULT_ERROR)
+			return decode_error(d);
+		if(emit(d, sink, ctx, sizeof(d->out) - avail_out))
+			return -1;
+	} while(res == BROTLI_DECODER_RESULT_NEEDS_MORE_OUTPUT);
+	d->done = res == BROTLI_DECODER_RESULT_SUCCESS;
+	return 0;
+}
+#endif
+
+#ifdef HAVE_ZSTD
+static int decode_zstd(struct decoder *d, const void *buf, size_t len, decode_sink sink, void *ctx)
+{
+	ZSTD_inBuffer in = {buf, len, 0};
+	ZSTD_outBuffer out;
+	long long start;
+	size_t ret;
+
+	do {
+		out.dst = d->out;
+		out.size = sizeof(d->out);
+		out.pos = 0;
+		start = cpu_ns();
+		ret = ZSTD_decompressStream(d->zstd, &out, &in);
+		d->decode_ns += cpu_ns() - start;
+		if(ZSTD_isError(ret))
+			return decode_error(d);
+		if(emit(d, sink, ctx, out.pos))
+			return -1;
+	} while(ret && (in.pos < in.size || out.pos == out.size));
+	/* Zero once a frame is decoded and flushed. */
+	d->done = !ret;
+	return 0;
+}
+#endif
+
+/* Decode a chunk of the body and pass it on. Anything after the end of a
+ * compressed stream is ignored. */
+int decoder_write(struct decoder *d, const void *buf, size_t len, decode_sink sink, void *ctx)
+{
+	d->wire_bytes += len;
+	if(d->done)
+		return 0;
+	switch(d->encoding) {
+#ifdef HAVE_ZLIB
+	case ENCODING_GZIP:
+	case ENCODING_DEFLATE:
+		return decode_zlib(d, buf, len, sink, ctx);
+#endif
+#ifdef HAVE_BROTLI
+	case ENCODING_BROTLI:
+		return decode_brotli(d, buf, len, sink, ctx);
+#endif
+#ifdef HAVE_ZSTD
+	case ENCODING_ZSTD:
+		return decode_zstd(d, buf, len, sink, ctx);
+#endif
+	}
+	d->decoded_bytes += len;
+	return sink(ctx, buf, len);
+}
+
+/* A compressed body that ended before its stream did was cut short, even if
+ * the transfer itself completed, and fails the result. */
+void decoder_result(const struct decoder *d, struct result *r)
+{
+	if(d->started && !d->done && d->encoding != ENCODING_IDENTITY && d->encoding != ENCODING_OTHER) {
+		fprintf(stderr, "Truncated %s content.\n", encoding_names[d->encoding]);
+		r->status = CURLE_BAD_CONTENT_ENCODING;
+	}
+	r->encoding = d->encoding;
+	r->wire_bytes = d->wire_bytes;
+	r->decoded_bytes = d->decoded_bytes;
+	r->decode_ns = d->decode_ns;
+}
+
+void decode_stats_add(const struct result *r)
+{
+	struct decode_stats *s = &totals[r->encoding];
+
+	if(r->url < 0 || r->status)
+		return;
+	s->responses++;
+	s->wire_bytes += r->wire_bytes;
+	s->decoded_bytes += r->decoded_bytes;
+	s->decode_ns += r->decode_ns;
+}
+
+/* A line per encoding the responses came in. */
+void decode_stats_print(FILE *output)
+{
+	const struct decode_stats *s;
+	int e;
+
+	for(e = 0; e < NUM_ENCODINGS; e++) {
+		s = &totals[e];
+		if(!s->responses)
+			continue;
+		fprintf(output, "Content encoding %s: %d responses, %ld bytes on the wire", encoding_names[e],
+			s->responses, s->wire_bytes);
+		if(s->decode_ns)
+			fprintf(output, " decoded to %ld (%.2fx) in %.3f ms of CPU time (%.1f MB/s).\n",
+				s->decoded_bytes, (double)s->decoded_bytes / max(s->wire_bytes, 1),
+				s->decode_ns / 1e6, s->decoded_bytes / (s->decode_ns / 1e3));
+		else
+			fputs(".\n", output);
+	}
+}
@@ -5,213 +5,847 @@
  * 2014-05-07
  */
 
+#include <math.h>
+#include <signal.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/eventfd.h>
 #include <sys/select.h>
 #include "getter.h"
 #include "worker.h"
+#include "ring.h"
+#include "resolve.h"
+#include "adaptive.h"
+#include "profile.h"
+#include "live.h"
+#include "trace.h"
+#include "sample.h"
+#include "verify.h"
+#include "decode.h"
+#include "throughput.h"
+#include "engine.h"
+#include "output.h"
+#include "scheduler.h"
+#include "stats.h"
+#include "urlstats.h"
 #include "util.h"
 
-static int get_urls(struct worker *w, char **urls, char *urls_loc, int *total_bytes)
+#define HEDGE_MIN_SAMPLES 20
+#define REPLAY_SLICE_NS 1000000
+
+static struct worker *workers = NULL;
+static int keepalive = 0;
+static int concurrency = 0;
+static int efd = -1;
+
+/* The worker replies with a status line, the list's cache validators, and
+ * the parsed list in one message holding the raw string arena, which becomes
+ * the arena of the cycle's URL table. */
+static int read_urls(struct worker *w, struct cycle *c, struct result *r, const char *buf)
 {
-	char buf[PIPE_BUF+1] = {0}, outbuf[PIPE_BUF+1] = {0};
+	struct url_list *list;
+	char validators[PIPE_BUF+1] = {0}, *last_modified;
+	long t[NUM_TIMES], code;
+	char *arena = NULL;
+	size_t size = 0;
 	int len, i, err;
-	size_t bytes = 0, urls_c = 0;
-	len = snprintf(outbuf, sizeof(outbuf)-1, "URLLIST %s", urls_loc);
-	outbuf[len] = '\0';
+	size_t urls_c = 0;
 
-	if(msg_write(w->pipe_w, outbuf, len) ||
-	   (len = msg_read(w->pipe_r, buf, sizeof(buf))) < 0)
-		return -1;
-
-	if(sscanf(buf, "OK %lu bytes %lu urls", &bytes, &urls_c)) {
-		*total_bytes += bytes;
-		if(!urls_c) return 0;
-		for(i = 0; i < urls_c; i++) {
-			if((len = msg_read(w->pipe_r, buf, sizeof(buf))) == -1) {
-				continue;
-			}
-			buf[len] = '\0';
-			urls[i] = malloc(len+1);
-			if(urls[i] == NULL) {
-				perror("malloc");
-				return i;
-			}
-			memcpy(urls[i], buf, len+1);
+	if(sscanf(buf, "OK %ld bytes %lu urls %ld conns %ld %ld %ld %ld %ld %ld", &r->bytes, &urls_c, &r->connects,
+		  &t[TIME_NAMELOOKUP], &t[TIME_CONNECT], &t[TIME_APPCONNECT],
+		  &t[TIME_STARTTRANSFER], &t[TIME_TOTAL], &code) == 4 + NUM_TIMES) {
+		for(i = 0; i < NUM_TIMES; i++) r->times[i] = t[i];
+		r->code = code;
+		if(msg_read(w->pipe_r, validators, sizeof(validators)) < 0 ||
+		   (len = msg_read_alloc(w->pipe_r, &arena, &size)) < 0 ||
+		   !(list = url_list_new())) {
+			free(arena);
+			return -1;
 		}
+		if(url_table_adopt(&list->urls, arena, len, size)) {
+			url_list_put(list);
+			return -1;
+		}
+		if((last_modified = strchr(validators, '\n')))
+			*last_modified++ = '\0';
+		list = list_cache_update(code, list, validators, last_modified);
+		cycle_set_list(c, list, code == 304 ? LIST_NOT_MODIFIED : LIST_FETCHED);
 	} else if(sscanf(buf, "ERR %d", &err) == 1) {
-		fprintf(stderr, "cURL error: '%s' while getting URL list at %s.\n", curl_easy_strerror(err), urls_loc);
-		return -err;
+		if(!deadline_missed(&c->deadline, err))
+			fprintf(stderr, "cURL error: '%s' while getting URL list at %s.\n", curl_easy_strerror(err), w->url);
+		r->status = err;
+	}
+	return 0;
+}
+
+static char *buf = NULL;
+static size_t bufsize = 0;
+
+/* Only URL list replies come through the pipe; for a worker that is getting
+ * a URL, the pipe becoming readable means it has died. */
+static int read_result(struct worker *w)
+{
+	struct cycle *c = w->cycle;
+	struct result r;
+
+	if(w->url_idx != -1 || msg_read_alloc(w->pipe_r, &buf, &bufsize) <= 0) {
+		fprintf(stderr, "Worker %d exited unexpectedly.\n", w->pid);
+		return -1;
+	}
+	result_init(&r);
+	r.url = w->url_idx;
+	w->status = STATUS_READY;
+	w->cycle = NULL;
+
+	if(read_urls(w, c, &r, buf))
+		return -1;
+	cycle_add_result(c, &r);
+	return 0;
+}
+
+static int reserve_buf(size_t len)
+{
+	if(len <= bufsize)
+		return 0;
+	free(buf);
+	bufsize = len;
+	if(!(buf = malloc(bufsize))) {
+		perror("malloc");
+		bufsize = 0;
+		return -1;
+	}
+	return 0;
+}
+
+/* Bring the names a worker has pinned up to date with the ones resolved up
+ * front, if there are any. */
+static int send_resolve(struct worker *w)
+{
+	struct resolve_list *list = resolve_get();
+	struct curl_slist *e;
+	size_t len = sizeof("RESOLVE ");
+	char *p;
+	int ret = 0;
+
+	if(!list || w->resolve_gen == list->generation)
+		goto out;
+	for(e = list->entries; e; e = e->next)
+		len += strlen(e->data) + 1;
+	if((ret = reserve_buf(len)))
+		goto out;
+	p = buf + sprintf(buf, "RESOLVE ");
+	for(e = list->entries; e; e = e->next)
+		p += sprintf(p, "%s\n", e->data);
+	if(!(ret = msg_write(w->pipe_w, buf, p - buf)))
+		w->resolve_gen = list->generation;
+out:
+	resolve_put(list);
+	return ret;
+}
+
+/* Tell a worker to abort its request, and kick it out of any wait so that it
+ * notices. Its result is thrown away when it comes in. */
+static void cancel_worker(struct worker *w)
+{
+	atomic_store_explicit(&w->ring->cancel, w->seq, memory_order_relaxed);
+	kill(w->pid, SIGUSR1);
+	w->status = STATUS_CANCELLED;
+	w->cycle = NULL;
+	w->twin = NULL;
+}
+
+/* A request that has been running for longer than its cycle's hedging delay,
+ * and has not been hedged yet. */
+static int hedge_due(struct worker *w, const struct timespec *now)
+{
+	return w->status == STATUS_WORKING && w->url_idx != -1 && !w->hedged &&
+		w->cycle->hedge_ns && !w->cycle->expired &&
+		ts_diff_ns(now, &w->started) >= w->cycle->hedge_ns;
+}
+
+static struct worker *hedge_target(const struct timespec *now)
+{
+	struct worker *w;
+	for(w = workers; w; w = w->next) {
+		if(hedge_due(w, now))
+			return w;
 	}
-	return urls_c;
+	return NULL;
 }
 
-int get_once(struct worker *workers, char **urls_opt, size_t urls_l, char *urls_loc, int *requests)
+/* Milliseconds until the next request is due to be hedged (rounded up), or -1
+ * if none is. */
+static int hedge_timeout_ms(const struct timespec *now)
 {
 	struct worker *w;
-	int cururl = 0, total_bytes = 0, urls_alloc = 0, reqs = 0, err = 0, bytes, nfds, retval, len, i;
-	char **urls = urls_opt;
-	fd_set rfds;
-	char buf[PIPE_BUF+1] = {0}, outbuf[PIPE_BUF+1] = {0};
+	long long ns, first = -1;
 	for(w = workers; w; w = w->next) {
-		if(msg_write(w->pipe_w, "RESET", sizeof("RESET")))
-			return -1;
-		msg_read(w->pipe_r, buf, sizeof(buf));
-		w->status = STATUS_READY;
+		if(w->status != STATUS_WORKING || w->url_idx == -1 || w->hedged || !w->cycle->hedge_ns)
+			continue;
+		ns = max(w->cycle->hedge_ns - ts_diff_ns(now, &w->started), 0);
+		if(first < 0 || ns < first)
+			first = ns;
 	}
+	return first < 0 ? -1 : (first + 999999) / 1000000;
+}
 
-	if(urls_loc != NULL) {
-		urls = malloc(MAX_URLS * sizeof(urls));
-		if(!urls) {
-			perror("malloc()");
-			return -1;
+/* Collect the binary URL results the workers have put in their rings since
+ * the last wake-up. */
+static void drain_results()
+{
+	struct worker *w;
+	struct cycle *c;
+	struct result r;
+	uint64_t val;
+
+	if(read(efd, &val, sizeof(val)) < 0 && errno != EAGAIN)
+		perror("read()");
+	for(w = workers; w; w = w->next) {
+		if(w->status == STATUS_READY || w->url_idx == -1 || !ring_pop(w->ring, &r))
+			continue;
+		c = w->cycle;
+		r.url = w->url_idx;
+		r.worker = w->id;
+		r.started = w->issued;
+		w->cycle = NULL;
+		if(w->status == STATUS_CANCELLED) {
+			w->status = STATUS_READY;
+			continue;
 		}
-		if((len = get_urls(workers, urls, urls_loc, &total_bytes)) < 0) {
-			free(urls);
-			return len;
+		w->status = STATUS_READY;
+
+		/* The first copy of a hedged request to fail leaves it to the
+		 * other one; the first to succeed wins, and the other one is
+		 * cancelled. */
+		if(w->twin && r.status && !deadline_passed(&c->deadline)) {
+			w->twin->twin = NULL;
+			w->twin = NULL;
+			continue;
 		}
-		urls_alloc = 1;
-		urls_l = len;
-		reqs++;
+		if(w->twin)
+			cancel_worker(w->twin);
+		if(w->hedged)
+			r.hedge = w->hedge ? HEDGE_WON : HEDGE_LOST;
+		if(w->hedge)
+			result_delay(&r, ts_diff_ns(&w->started, &w->issued) / 1000);
+		if(r.status && !deadline_missed(&c->deadline, r.status))
+			fprintf(stderr, "cURL error: %s for URL '%s'.\n", curl_easy_strerror(r.status), w->url);
+		cycle_add_result(c, &r);
+	}
+}
+
+/* Hand the next queued request to an idle worker, or a duplicate of a request
+ * that is due to be hedged. Returns 1 if the worker was given something to do,
+ * 0 if there was nothing queued. The command carries the time left until the
+ * cycle's deadline (0 if none) ahead of the URL. */
+static int dispatch(struct worker *w, const struct timespec *now)
+{
+	const char *cmd, *etag = NULL, *last_modified = NULL;
+	struct worker *orig;
+	struct cycle *c;
+	long left_ms;
+	int idx, len;
+
+	if((orig = hedge_target(now))) {
+		c = orig->cycle;
+		idx = orig->url_idx;
+	} else if(!cycle_take(&c, &idx)) {
+		return 0;
 	}
 
+	if(send_resolve(w))
+		return -1;
+
+	/* Unless in keep-alive mode, workers start every cycle with fresh
+	 * handles (and thus fresh connections). */
+	if(!keepalive && w->cycle_id != c->id) {
+		if(msg_write(w->pipe_w, "RESET", sizeof("RESET")))
+			return -1;
+	}
+	w->cycle = c;
+	w->cycle_id = c->id;
+	w->url_idx = idx;
+	if(idx == -1) {
+		w->url = c->urls_loc;
+		cmd = "URLLIST ";
+		etag = list_cache_etag();
+		last_modified = list_cache_last_modified();
+	} else {
+		w->url = url_get(c->urls, idx);
+		cmd = "URL ";
+	}
+	left_ms = deadline_left_ms(&c->deadline);
+	len = strlen(cmd) + 21 + strlen(w->url) +
+		(etag ? strlen(etag) + sizeof("\nIf-None-Match: ") : 0) +
+		(last_modified ? strlen(last_modified) + sizeof("\nIf-Modified-Since: ") : 0);
+	if(reserve_buf(len + 1))
+		return -1;
+	len = sprintf(buf, "%s%ld %s", cmd, left_ms, w->url);
+	if(etag)
+		len += sprintf(buf + len, "\nIf-None-Match: %s", etag);
+	if(last_modified)
+		len += sprintf(buf + len, "\nIf-Modified-Since: %s", last_modified);
+	if(msg_write(w->pipe_w, buf, len) < 0)
+		return -1;
+	w->status = STATUS_WORKING;
+	w->seq++;
+	w->started = *now;
+	w->issued = orig ? orig->started : *now;
+	w->twin = orig;
+	w->hedge = w->hedged = orig != NULL;
+	if(orig) {
+		orig->twin = w;
+		orig->hedged = 1;
+	}
+	return 1;
+}
+
+static int fork_poll(const struct timespec *until)
+{
+	struct worker *w;
+	struct timespec now;
+	struct timeval tv;
+	fd_set rfds;
+	int nfds, retval, ms, hedge_ms, working, idle, i;
+
 	do {
 		FD_ZERO(&rfds);
-		nfds = -1;
-		for(w = workers; w; w = w->next) {
-			if(w->status == STATUS_READY && cururl < urls_l) {
-				w->url = urls[cururl++];
-				len = sprintf(outbuf, "URL %s", w->url);
-				if((err = msg_write(w->pipe_w, outbuf, len)) < 0)
-					goto out;
-				w->status = STATUS_WORKING;
-			}
-			if(w->status == STATUS_WORKING) {
+		FD_SET(efd, &rfds);
+		nfds = efd;
+		working = idle = 0;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		for(w = workers, i = 0; w; w = w->next, i++) {
+			if(w->status == STATUS_READY && i < concurrency && dispatch(w, &now) < 0)
+				return -1;
+			if(w->status == STATUS_READY)
+				idle |= i < concurrency;
+			else
 				FD_SET(w->pipe_r, &rfds);
-				nfds = max(nfds, w->pipe_r);
-			}
+			nfds = max(nfds, w->pipe_r);
+			if(w->status == STATUS_WORKING)
+				working = 1;
 		}
-		if(nfds == -1) break;
+		if(!working) return 0;
 		nfds++;
-		retval = select(nfds, &rfds, NULL, NULL, NULL);
+
+		/* With a worker to spare, wake up when the next hedge is due. */
+		ms = sched_timeout_ms(until);
+		if(ms == 0) return 0;
+		if(idle && (hedge_ms = hedge_timeout_ms(&now)) >= 0 && (ms < 0 || hedge_ms < ms))
+			ms = hedge_ms;
+		tv.tv_sec = ms / 1000;
+		tv.tv_usec = (ms % 1000) * 1000;
+
+		retval = select(nfds, &rfds, NULL, NULL, ms >= 0 ? &tv : NULL);
 		if(retval == -1) {
+			if(errno == EINTR) return 0;
 			perror("select()");
-			err = retval;
-			goto out;
+			return -1;
 		}
+		if(FD_ISSET(efd, &rfds))
+			drain_results();
 		for(w = workers; w; w = w->next) {
-			if(FD_ISSET(w->pipe_r, &rfds)) {
-				if((len = msg_read(w->pipe_r, buf, sizeof(buf))) == -1) {
-					continue;
-				}
-				buf[len] = '\0';
-				if(sscanf(buf, "OK %d bytes", &bytes) == 1) {
-					total_bytes += bytes;
-					reqs++;
-				} else if(sscanf(buf, "ERR %d", &err) == 1) {
-					fprintf(stderr, "cURL error: %s for URL '%s'.\n", curl_easy_strerror(err), w->url);
-				}
-				w->status = STATUS_READY;
-			}
+			if(w->status != STATUS_READY && FD_ISSET(w->pipe_r, &rfds) && read_result(w))
+				return -1;
 		}
 	} while(1);
+}
 
-out:
-	if(urls_alloc) {
-		for(i = 0; i < urls_l; i++) {
-			free(urls[i]);
+static int fork_start_cycle(struct cycle *c)
+{
+	cycle_start(c);
+	return 0;
+}
+
+static void fork_destroy()
+{
+	struct worker *w;
+	for(w = workers; w; w = w->next) kill_worker(w);
+	if(efd != -1) close(efd);
+	efd = -1;
+}
+
+static int fork_init(struct options *opt)
+{
+	struct worker *w;
+	int i;
+	keepalive = opt->keepalive;
+	concurrency = opt->workers;
+	/* One eventfd for all workers, so a single read collects the wake-ups
+	 * for a whole batch of results. */
+	if((efd = eventfd(0, EFD_NONBLOCK)) < 0) {
+		perror("eventfd()");
+		return -1;
+	}
+	for(i = 0; i < opt->workers; i++) {
+		w = malloc(sizeof(*w));
+		if(w == NULL) {
+			perror("malloc");
+			return -1;
+		}
+		w->id = i;
+		w->efd = efd;
+		/* Stop the workers already started, and close the eventfd. */
+		if(start_worker(w, opt) != 0) {
+			free(w);
+			fork_destroy();
+			return -1;
 		}
-		free(urls);
+		w->next = workers;
+		workers = w;
 	}
-	*requests = reqs;
-	return err ? -err : total_bytes;
+	return 0;
 }
 
-static void schedule_next(int interval, struct timeval *now, struct timeval *next)
+/* Only the first n workers in the list are given work. */
+static void fork_set_concurrency(int n)
 {
-	int delay = interval * 1000;
-	next->tv_sec = now->tv_sec;
-	next->tv_usec = now->tv_usec + delay;
-	if(next->tv_usec > 1000000) {
-		next->tv_sec += next->tv_usec / 1000000;
-		next->tv_usec %= 1000000;
-	}
+	concurrency = n;
 }
 
+struct engine fork_engine = {
+	.name = "fork",
+	.init = fork_init,
+	.start_cycle = fork_start_cycle,
+	.poll = fork_poll,
+	.set_concurrency = fork_set_concurrency,
+	.destroy = fork_destroy,
+};
 
-static struct worker *workers = NULL;
+
+static struct engine *engine = NULL;
 
 void kill_workers()
 {
-	struct worker *w;
-	for(w = workers; w; w = w->next) kill_worker(w);
+	if(engine) engine->destroy();
 }
 
 static double min_time = -1, max_time = -1, total_time = 0;
 static int total_count = 0, success_count = 0, total_requests = 0;
+static int missed_count = 0, missed_requests = 0;
+static int hedging = 0, hedged_requests = 0, hedge_wins = 0;
+static struct histogram cycle_hist, request_hist, lag_hist, list_hist, resolve_hist;
+static int sched_mode = SCHED_CLOSED, loop_err = -1, stopping = 0;
+static int output_format = FORMAT_TEXT, url_stats = 0;
+static FILE *cycle_output = NULL;
+static struct adaptive adapt;
+static struct profile *profile = NULL;
+static struct timespec run_start;
+static int replaying = 0;
+volatile sig_atomic_t interrupted = 0;
+static int verifying = 0, sampling = 0, decoding = 0, goodput = 0, resolving = 0;
 
+/* With a structured output format the summary goes to stderr, so the output
+ * itself stays machine-readable. */
 void print_stats(FILE *output)
 {
+	if(url_stats)
+		url_stats_output();
+	output_flush();
+	if(output_format != FORMAT_TEXT) output = stderr;
 	if(success_count == 0) min_time = max_time;
 	fprintf(output, "\nTotal %d successful of %d cycles. %d total requests. min/avg/max = %.3f/%.3f/%.3f seconds.\n",
 		success_count, total_count, total_requests, min_time, total_time/success_count, max_time);
+	if(missed_count)
+		fprintf(output, "%d cycles missed their deadline, with %d requests cut short or never started.\n",
+			missed_count, missed_requests);
+	if(hedging)
+		fprintf(output, "Hedges fired for %d requests and won %d times.\n",
+			hedged_requests, hedge_wins);
+	if(verifying)
+		verify_print(output);
+	if(decoding)
+		decode_stats_print(output);
+	if(goodput)
+		throughput_stats_print(output);
+	if(adapt.mode != ADAPT_NONE)
+		fprintf(output, "Concurrency ended at %d, ranging from %d to %d.\n",
+			adapt.current, adapt.low, adapt.high);
+	hist_print(output, "Cycle time", &cycle_hist);
+	hist_print(output, "Request time", &request_hist);
+	if(sched_mode != SCHED_CLOSED)
+		hist_print(output, "Start lag", &lag_hist);
+	if(list_hist.count)
+		hist_print(output, "URL list fetch time", &list_hist);
+	if(resolve_hist.count)
+		hist_print(output, "DNS pre-resolution time", &resolve_hist);
+	if(url_stats)
+		url_stats_print(output);
+	if(profile)
+		profile_print(profile, output);
 }
 
-int get_loop(struct options *opt)
+static const char *list_status_names[] = {
+	[LIST_FETCHED] = "fetched",
+	[LIST_NOT_MODIFIED] = "not modified",
+	[LIST_CACHED] = "cached",
+};
+
+static void request_done(const struct cycle *c, const struct result *r)
+{
+	struct result checked;
+
+	if(verifying) {
+		checked = *r;
+		verify_result(c, &checked);
+		r = &checked;
+	}
+	output_request(c, r);
+	if(decoding)
+		decode_stats_add(r);
+	if(goodput)
+		throughput_stats_add(r);
+	if(url_stats)
+		url_stats_add(c, r);
+	if(profile)
+		profile_add_result(profile, c, r);
+	live_request(c, r);
+	trace_record(r, &run_start);
+}
+
+/* A cycle that missed its deadline still says the concurrency is too low; one
+ * that failed says nothing. */
+static void adjust_concurrency(const struct cycle *c, long long duration)
+{
+	int prev = adapt.current;
+	if(adapt.mode == ADAPT_NONE || c->err)
+		return;
+	if(adaptive_update(&adapt, c->stats.requests, duration) != prev)
+		engine->set_concurrency(adapt.current);
+}
+
+/* Called by the cycle queue once every request of a cycle has completed. In
+ * the open-loop modes the cycle time is measured from the intended start
+ * time, so that a slow target also shows up as latency on the cycles that
+ * were delayed behind it. */
+static void finish_cycle(struct cycle *c)
 {
-	struct timeval start, end, stop, next;
+	struct timeval now;
+	long long lag, duration;
 	double time;
-	struct worker *w;
-	int i, bytes;
-	int count = 0, requests = 0, err = -1;
-	for(i = 0; i < opt->workers; i++) {
-		w = malloc(sizeof(*w));
-		if(w == NULL) {
+
+	total_count++;
+	lag = max(ts_diff_ns(&c->start, &c->intended), 0);
+	hist_record(&lag_hist, lag / 1000);
+	duration = ts_diff_ns(&c->end, sched_mode == SCHED_CLOSED ? &c->start : &c->intended);
+	output_cycle(c, duration, lag);
+	hedged_requests += c->stats.hedged;
+	hedge_wins += c->stats.hedge_wins;
+	adjust_concurrency(c, duration);
+	if(profile)
+		profile_add_cycle(profile, c->id, c->stats.missed);
+	live_cycle(c, duration, !c->err && !c->stats.missed && c->bytes);
+
+	if(c->err) {
+		loop_err = c->err;
+		stopping = 1;
+	} else if(c->stats.missed) {
+		/* The loop keeps going; the next cycle has already started on
+		 * time. */
+		fprintf(stderr, "Cycle %d missed its deadline with %d of %d requests unfinished.\n",
+			c->id, c->stats.missed, c->stats.requests + c->stats.errors + c->stats.missed);
+		missed_count++;
+		missed_requests += c->stats.missed;
+		loop_err = 0;
+	} else if(c->bytes == 0) {
+		fprintf(stderr, "Error: Nothing received.\n");
+		loop_err = 1;
+	} else {
+		time = duration / 1e9;
+		if(time < min_time || min_time < 0) min_time = time;
+		if(time > max_time || max_time < 0) max_time = time;
+		hist_record(&cycle_hist, duration / 1000);
+		if(c->urls_loc && c->list_status != LIST_CACHED)
+			hist_record(&list_hist, c->list_time);
+		success_count++;
+		total_requests += c->stats.requests;
+		total_time += time;
+		loop_err = 0;
+		if(output_format != FORMAT_TEXT || replaying)
+			goto out;
+
+		gettimeofday(&now, NULL);
+		fprintf(cycle_output, "[%lu.%06lu] %d requests(s) received %lu bytes in %f seconds.", (long)now.tv_sec, (long)now.tv_usec, c->stats.requests, c->bytes, time);
+		fprintf(cycle_output, " %ld new connection(s).", c->stats.connects);
+		if(sched_mode != SCHED_CLOSED)
+			fprintf(cycle_output, " Started %.3f ms late.", (double)lag / 1000000);
+		if(hedging)
+			fprintf(cycle_output, " %d hedged, %d won.", c->stats.hedged, c->stats.hedge_wins);
+		if(adapt.mode != ADAPT_NONE)
+			fprintf(cycle_output, " Concurrency %d.", c->concurrency);
+		if(c->urls_loc)
+			fprintf(cycle_output, " URL list %s in %.3f ms, content in %f seconds.",
+				list_status_names[c->list_status], (double)c->list_time / 1000,
+				ts_diff_ns(&c->end, c->list_status == LIST_CACHED ? &c->start : &c->list_done) / 1e9);
+		print_cycle_timings(cycle_output, &c->stats);
+		fputc('\n', cycle_output);
+		fflush(cycle_output);
+	}
+out:
+	cycle_free(c);
+}
+
+/* The hedging delay for the next cycle: fixed, or the given percentile of the
+ * request times seen so far (once there are enough of them to go by). */
+static long long hedge_delay_ns(struct options *opt)
+{
+	if(opt->hedge_percentile)
+		return request_hist.count < HEDGE_MIN_SAMPLES ? 0 :
+			(long long)hist_percentile(&request_hist, opt->hedge_percentile) * 1000;
+	return (long long)opt->hedge_delay * 1000000;
+}
+
+/* Run the engine until *until (or, if until is NULL, until no cycles are left
+ * running), expiring cycles as their deadlines pass. */
+static int run_engine(const struct timespec *until)
+{
+	const struct timespec *deadline, *t;
+	struct timespec now;
+
+	while(1) {
+		deadline = cycles_next_deadline();
+		t = deadline && (!until || ts_diff_ns(deadline, until) < 0) ? deadline : until;
+		if(engine->poll(t) < 0)
+			return -1;
+		if(interrupted || !deadline)
+			return 0;
+		/* Pollers can return up to a millisecond early. */
+		if(t == deadline && cycles_running())
+			sched_sleep(deadline);
+		cycles_expire();
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if(until ? ts_diff_ns(&now, until) >= 0 : !cycles_running())
+			return 0;
+	}
+}
+
+/* Set the cycle rate and concurrency to where the load profile is at now.
+ * Returns 0 once the profile is over. */
+static int follow_profile(struct options *opt, struct scheduler *sched, const struct timespec *now,
+			  int count, long long *interval_ns, int *limit)
+{
+	double rate = 0, conc = 0;
+	int n;
+
+	if(!profile_next(profile, now, count, &rate, &conc))
+		return 0;
+	if(rate) {
+		*interval_ns = NSEC_PER_SEC / rate;
+		sched_set_interval(sched, *interval_ns);
+	}
+	if(conc && (n = max(1, min((int)lround(conc), opt->workers))) != *limit) {
+		*limit = n;
+		engine->set_concurrency(n);
+	}
+	return 1;
+}
+
+static int start_cycle(struct options *opt, struct cycle *c, const struct timespec *intended,
+		       long long deadline_ns, int concurrency)
+{
+	c->stats.request_hist = &request_hist;
+	c->intended = *intended;
+	clock_gettime(CLOCK_MONOTONIC, &c->start);
+	if(deadline_ns) {
+		c->deadline = sched_mode == SCHED_CLOSED ? c->start : c->intended;
+		ts_add_ns(&c->deadline, deadline_ns);
+	}
+	c->hedge_ns = hedge_delay_ns(opt);
+	c->concurrency = concurrency;
+	return engine->start_cycle(c);
+}
+
+/* Issue the requests of a trace at their offsets from its first request. The
+ * requests due within the same slice of time are started together, as one
+ * cycle of just those URLs. */
+static int replay(struct options *opt, const struct timespec *stop, int *count)
+{
+	const struct trace_entry *e;
+	struct timespec due, now;
+	struct trace trace;
+	struct cycle *c;
+	size_t pos, end, n;
+	int64_t base, slice;
+	int ret = -1, skipped = 0;
+
+	if(trace_map(&trace, opt->replay))
+		return -1;
+	base = trace.count ? trace_get(&trace, 0)->offset_ns : 0;
+	for(pos = 0; pos < trace.count; pos = end) {
+		e = trace_get(&trace, pos);
+		due = run_start;
+		ts_add_ns(&due, e->offset_ns - base);
+		if(run_engine(&due) < 0)
+			goto out;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if(stopping || interrupted || (opt->run_length && ts_diff_ns(&now, stop) >= 0))
+			break;
+		sched_sleep(&due);
+		if(interrupted)
+			break;
+
+		slice = e->offset_ns + REPLAY_SLICE_NS;
+		for(end = pos; end < trace.count && trace_get(&trace, end)->offset_ns < slice; end++);
+		if(!(c = cycle_new(*count, &opt->urls, NULL)))
+			goto out;
+		if(!(c->indexes = malloc((end - pos) * sizeof(*c->indexes)))) {
 			perror("malloc");
-			exit(EXIT_FAILURE);
+			cycle_free(c);
+			goto out;
 		}
-		if(start_worker(w, opt) != 0) exit(EXIT_FAILURE);
-		w->next = workers;
-		workers = w;
+		for(n = 0; pos < end; pos++) {
+			e = trace_get(&trace, pos);
+			if(e->url < 0 || e->url >= opt->urls.count)
+				skipped++;
+			else
+				c->indexes[n++] = e->url;
+		}
+		if(!(c->nindexes = n)) {
+			cycle_free(c);
+			continue;
+		}
+		(*count)++;
+		if(start_cycle(opt, c, &due, (long long)opt->deadline * 1000000, opt->workers) < 0)
+			goto out;
 	}
-	gettimeofday(&stop, NULL);
-	start.tv_sec = next.tv_sec = stop.tv_sec;
-	start.tv_usec = next.tv_usec = stop.tv_usec;
+	ret = 0;
+out:
+	if(skipped)
+		fprintf(stderr, "Skipped %d trace entries for URLs not in the URL file.\n", skipped);
+	trace_unmap(&trace);
+	return ret;
+}
+
+/* Once the URL table of a cycle is known: take the digests off the lines of a
+ * fetched list before any of its URLs are used, draw the URLs to get, and
+ * have the names of a new list looked up. */
+static void pick_urls(struct cycle *c)
+{
+	if(verifying)
+		verify_cycle(c);
+	if(sampling)
+		sample_cycle(c);
+	if(resolving)
+		resolve_cycle(c);
+}
+
+int get_loop(struct options *opt)
+{
+	struct timespec stop, now, intended;
+	struct scheduler sched;
+	struct cycle *c;
+	long long interval_ns = (long long)opt->interval * 1000000, deadline_ns;
+	int count = 0, limit = opt->workers;
+
+	/* Before the names are resolved, since the digests and weights of a
+	 * URL file come off its lines then. */
+	verifying = opt->verify;
+	decoding = opt->encodings != NULL;
+	if((goodput = opt->throughput_interval > 0))
+		throughput_stats_init(opt->throughput_interval);
+	if(verifying && verify_init(&opt->urls))
+		exit(EXIT_FAILURE);
+	sampling = opt->sample_mode != SAMPLE_NONE;
+	if(sample_init(opt->sample_mode, opt->zipf_s, opt->sample_count, &opt->urls))
+		exit(EXIT_FAILURE);
+	/* Resolve names before the engine starts, so it is not timed as part
+	 * of any cycle. */
+	resolving = opt->resolve_refresh >= 0;
+	if(resolving && resolve_init(opt, &resolve_hist))
+		exit(EXIT_FAILURE);
+
+	switch(opt->engine) {
+	case ENGINE_MULTI:
+		engine = &multi_engine;
+		break;
+	case ENGINE_THREAD:
+		engine = &thread_engine;
+		break;
+	default:
+		engine = &fork_engine;
+		break;
+	}
+	if(engine->init(opt) != 0) exit(EXIT_FAILURE);
+	adaptive_init(&adapt, opt->adapt_mode, opt->adapt_target, opt->workers);
+	if(adapt.mode != ADAPT_NONE)
+		engine->set_concurrency(adapt.current);
+	/* After the engine has forked its workers, so that they do not inherit
+	 * the server thread's socket. */
+	if(opt->stats_socket && live_init(opt->stats_socket))
+		exit(EXIT_FAILURE);
+	cycle_output = opt->output;
+	output_format = opt->format;
+	if(output_init(opt->output, opt->format, verifying, decoding, goodput))
+		exit(EXIT_FAILURE);
+	if(opt->trace_out && trace_record_open(opt->trace_out))
+		exit(EXIT_FAILURE);
+	sched_mode = opt->schedule;
+	hedging = opt->hedge_delay || opt->hedge_percentile;
+	url_stats = opt->url_stats;
+	cycles_init(request_done, finish_cycle, verifying || sampling || resolving ? pick_urls : NULL);
+	list_cache_init(opt->list_refresh);
+	sched_init(&sched, opt->schedule, opt->interval);
+	clock_gettime(CLOCK_MONOTONIC, &run_start);
+	stop = run_start;
 	stop.tv_sec += opt->run_length;
+	if((profile = opt->profile))
+		profile_start(profile, &run_start, opt->workers);
 
-	do {
-		gettimeofday(&start, NULL);
-		while(start.tv_sec < next.tv_sec || (start.tv_sec == next.tv_sec && start.tv_usec < next.tv_usec)) {
-			if(next.tv_usec - start.tv_usec > USLEEP_THRESHOLD)
-				usleep(USLEEP_THRESHOLD);
-			gettimeofday(&start, NULL);
-		}
-		schedule_next(opt->interval, &start, &next);
-		bytes = get_once(workers, opt->urls, opt->urls_l, opt->urls_loc, &requests);
-		gettimeofday(&end, NULL);
-		count++;
-		total_count++;
-		if(bytes < 0) {
-			err = -bytes;
+	if((replaying = opt->replay != NULL)) {
+		if(replay(opt, &stop, &count) < 0)
+			goto fatal;
+		goto drain;
+	}
+
+	while(1) {
+		/* In closed-loop mode, a cycle has to complete before the next one
+		 * is scheduled. */
+		if(sched_mode == SCHED_CLOSED && run_engine(NULL) < 0)
+			goto fatal;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if(stopping || interrupted || (opt->count && count >= opt->count) ||
+		   (opt->run_length && ts_diff_ns(&now, &stop) >= 0) ||
+		   (profile && !follow_profile(opt, &sched, &now, count, &interval_ns, &limit)))
 			break;
-		} else if(bytes == 0) {
-			fprintf(stderr, "Error: Nothing received.\n");
-			err = 1;
-		} else {
-			time = end.tv_sec - start.tv_sec;
-			time += (double)(end.tv_usec - start.tv_usec) / 1000000;
-			if(time < min_time || min_time < 0) min_time = time;
-			if(time > max_time || max_time < 0) max_time = time;
-			success_count++;
-			total_requests += requests;
-			total_time += time;
-			fprintf(opt->output, "[%lu.%06lu] %d requests(s) received %lu bytes in %f seconds.\n", (long)end.tv_sec, (long)end.tv_usec, requests, (long)bytes, time);
-			fflush(opt->output);
-			err = 0;
-		}
-	} while((opt->count == 0 || count < opt->count) &&
-		(opt->run_length == 0 || end.tv_sec < stop.tv_sec || (end.tv_sec == stop.tv_sec && end.tv_usec < stop.tv_usec)));
+
+		resolve_update();
+		sched_next(&sched, &intended);
+		if(sched_mode != SCHED_CLOSED && run_engine(&intended) < 0)
+			goto fatal;
+		if(stopping || interrupted)
+			break;
+		sched_sleep(&intended);
+		if(interrupted)
+			break;
+
+		c = cycle_new(count++, &opt->urls, opt->urls_loc);
+		if(!c)
+			goto fatal;
+		/* A deadline left unset follows the profile's rate. */
+		deadline_ns = opt->deadline >= 0 ? (long long)opt->deadline * 1000000 : interval_ns;
+		if(start_cycle(opt, c, &intended, deadline_ns,
+			       adapt.mode != ADAPT_NONE ? adapt.current : limit) < 0)
+			goto fatal;
+		sched_started(&sched, &c->start);
+	}
+drain:
+	if(!stopping && !interrupted && run_engine(NULL) < 0)
+		goto fatal;
+	goto out;
+
+fatal:
+	loop_err = 1;
+out:
 	kill_workers();
-	print_stats(opt->output);
-	return err;
+	engine = NULL;
+	list_cache_destroy();
+	resolve_destroy();
+	live_destroy();
+	trace_record_close();
+	if(interrupted != SIGTERM)
+		print_stats(opt->output);
+	url_stats_destroy();
+	sample_destroy();
+	verify_destroy();
+	return loop_err;
 }
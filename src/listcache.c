@@ -0,0 +1,109 @@
+/**
+ * listcache.c
+ *
+ * Toke Høiland-Jørgensen
+ * 2026-10-17
+ *
+ * Cache of the remote URL list, so it does not have to be downloaded and
+ * parsed again every cycle. The list is revalidated with If-None-Match /
+ * If-Modified-Since, and within the minimum refresh interval it is not
+ * requested at all.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "listcache.h"
+#include "util.h"
+
+static struct url_list *cached = NULL;
+static char *etag = NULL, *last_modified = NULL;
+static struct timespec fetched;
+static long long min_refresh_ns = 0;
+
+struct url_list *url_list_new()
+{
+	struct url_list *l = malloc(sizeof(*l));
+	if(!l) {
+		perror("malloc");
+		return NULL;
+	}
+	url_table_init(&l->urls);
+	l->refs = 1;
+	return l;
+}
+
+void url_list_put(struct url_list *l)
+{
+	if(!l || --l->refs)
+		return;
+	url_table_destroy(&l->urls);
+	free(l);
+}
+
+void list_cache_init(int min_refresh_ms)
+{
+	min_refresh_ns = (long long)min_refresh_ms * 1000000;
+}
+
+void list_cache_destroy()
+{
+	url_list_put(cached);
+	cached = NULL;
+	free(etag);
+	free(last_modified);
+	etag = last_modified = NULL;
+}
+
+/* Return a reference to the cached list if it is recent enough to be used
+ * without asking the server, or NULL if it has to be (re)validated. */
+struct url_list *list_cache_get()
+{
+	struct timespec now;
+	if(!cached || !min_refresh_ns)
+		return NULL;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if(ts_diff_ns(&now, &fetched) >= min_refresh_ns)
+		return NULL;
+	cached->refs++;
+	return cached;
+}
+
+const char *list_cache_etag()
+{
+	return cached ? etag : NULL;
+}
+
+const char *list_cache_last_modified()
+{
+	return cached ? last_modified : NULL;
+}
+
+static char *dup_header(const char *value)
+{
+	return value && *value ? strdup(value) : NULL;
+}
+
+/* Record the outcome of a list fetch, and return a reference to the list the
+ * cycle should use: the cached one on a 304, otherwise the fresh one (which
+ * the cache takes over if it was a successful response). */
+struct url_list *list_cache_update(long code, struct url_list *fresh, const char *new_etag, const char *new_last_modified)
+{
+	if(code == 304 && cached) {
+		clock_gettime(CLOCK_MONOTONIC, &fetched);
+		url_list_put(fresh);
+		cached->refs++;
+		return cached;
+	}
+	if(!fresh || code < 200 || code >= 300)
+		return fresh;
+
+	clock_gettime(CLOCK_MONOTONIC, &fetched);
+	url_list_put(cached);
+	free(etag);
+	free(last_modified);
+	cached = fresh;
+	etag = dup_header(new_etag);
+	last_modified = dup_header(new_last_modified);
+	cached->refs++;
+	return cached;
+}
@@ -0,0 +1,264 @@
+/**
+ * live.c
+ *
+ * Toke Høiland-Jørgensen
+ * 2026-10-17
+ *
+ * Live statistics. The counters are only ever written by the main thread, as
+ * results come in, so they are updated with relaxed loads and stores rather
+ * than read-modify-write atomics; that is a plain increment on the hot path.
+ * A helper thread serves snapshots of them on a Unix domain socket.
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "live.h"
+#include "stats.h"
+#include "util.h"
+#include "verify.h"
+
+/* How long a client has to ask for JSON before it gets text. */
+#define LIVE_REQUEST_MS 100
+
+enum {
+	LIVE_CYCLES,
+	LIVE_CYCLES_OK,
+	LIVE_CYCLES_MISSED,
+	LIVE_CYCLES_FAILED,
+	LIVE_REQUESTS,
+	LIVE_ERRORS,
+	LIVE_BYTES,
+	LIVE_CONNECTS,
+	LIVE_HEDGED,
+	LIVE_HEDGE_WINS,
+	LIVE_VERIFY_FAILED,
+	LIVE_CONCURRENCY,
+	NUM_LIVE,
+};
+
+static const char *live_names[NUM_LIVE] = {
+	[LIVE_CYCLES] = "cycles",
+	[LIVE_CYCLES_OK] = "cycles_ok",
+	[LIVE_CYCLES_MISSED] = "cycles_missed",
+	[LIVE_CYCLES_FAILED] = "cycles_failed",
+	[LIVE_REQUESTS] = "requests",
+	[LIVE_ERRORS] = "errors",
+	[LIVE_BYTES] = "bytes",
+	[LIVE_CONNECTS] = "connects",
+	[LIVE_HEDGED] = "hedged",
+	[LIVE_HEDGE_WINS] = "hedge_wins",
+	[LIVE_VERIFY_FAILED] = "verify_failed",
+	[LIVE_CONCURRENCY] = "concurrency",
+};
+
+struct live_hist {
+	_Atomic uint64_t max;
+	_Atomic uint32_t counts[CHIST_BUCKETS];
+};
+
+static struct {
+	_Atomic uint64_t counters[NUM_LIVE];
+	struct live_hist request_time;
+	struct live_hist cycle_time;
+} live;
+
+static int enabled = 0;
+static int sock = -1;
+static char *sock_path = NULL;
+static pthread_t server_thread;
+static int serving = 0;
+static struct timespec start;
+
+static inline void live_add(_Atomic uint64_t *c, uint64_t n)
+{
+	atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+static void live_record(struct live_hist *h, uint64_t value)
+{
+	_Atomic uint32_t *c = &h->counts[chist_index(value)];
+	atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + 1, memory_order_relaxed);
+	if(value > atomic_load_explicit(&h->max, memory_order_relaxed))
+		atomic_store_explicit(&h->max, value, memory_order_relaxed);
+}
+
+/* A transfer cut short by the deadline shows in the missed cycles, as in the
+ * final report. */
+void live_request(const struct cycle *c, const struct result *r)
+{
+	if(!enabled || r->url < 0 || deadline_missed(&c->deadline, r->status))
+		return;
+	if(r->status) {
+		live_add(&live.counters[LIVE_ERRORS], 1);
+		return;
+	}
+	live_add(&live.counters[LIVE_REQUESTS], 1);
+	if(r->verify == VERIFY_MISMATCH || r->verify == VERIFY_CHANGED)
+		live_add(&live.counters[LIVE_VERIFY_FAILED], 1);
+	live_record(&live.request_time, r->times[TIME_TOTAL]);
+}
+
+void live_cycle(const struct cycle *c, long long duration_ns, int ok)
+{
+	if(!enabled)
+		return;
+	live_add(&live.counters[LIVE_CYCLES], 1);
+	if(ok) {
+		live_add(&live.counters[LIVE_CYCLES_OK], 1);
+		live_record(&live.cycle_time, duration_ns / 1000);
+	} else if(c->err) {
+		live_add(&live.counters[LIVE_CYCLES_FAILED], 1);
+	} else if(c->stats.missed) {
+		live_add(&live.counters[LIVE_CYCLES_MISSED], 1);
+	}
+	live_add(&live.counters[LIVE_BYTES], c->bytes);
+	live_add(&live.counters[LIVE_CONNECTS], c->stats.connects);
+	live_add(&live.counters[LIVE_HEDGED], c->stats.hedged);
+	live_add(&live.counters[LIVE_HEDGE_WINS], c->stats.hedge_wins);
+	atomic_store_explicit(&live.counters[LIVE_CONCURRENCY], c->concurrency, memory_order_relaxed);
+}
+
+static void snapshot_hist(struct compact_histogram *out, struct live_hist *h)
+{
+	int i;
+	out->count = 0;
+	for(i = 0; i < CHIST_BUCKETS; i++) {
+		out->counts[i] = atomic_load_explicit(&h->counts[i], memory_order_relaxed);
+		out->count += out->counts[i];
+	}
+	out->max = atomic_load_explicit(&h->max, memory_order_relaxed);
+}
+
+static const double percentiles[] = {50, 90, 99, 99.9};
+static const char *percentile_names[] = {"p50", "p90", "p99", "p99_9"};
+
+static void print_hist(FILE *f, int json, const char *name, const struct compact_histogram *h)
+{
+	int i;
+	for(i = 0; i < sizeof(percentiles) / sizeof(*percentiles); i++)
+		fprintf(f, json ? ",\"%s_%s_us\":%lu" : "%s_%s_us %lu\n", name, percentile_names[i],
+			(unsigned long)chist_percentile(h, percentiles[i]));
+	fprintf(f, json ? ",\"%s_max_us\":%lu,\"%s_count\":%u" : "%s_max_us %lu\n%s_count %u\n",
+		name, (unsigned long)h->max, name, h->count);
+}
+
+static void serve(int fd)
+{
+	static struct compact_histogram request_time, cycle_time;
+	struct pollfd pfd = {.fd = fd, .events = POLLIN};
+	struct timespec now;
+	char req[16] = {0};
+	int json = 0, i;
+	FILE *f;
+
+	if(poll(&pfd, 1, LIVE_REQUEST_MS) > 0 && read(fd, req, sizeof(req) - 1) > 0)
+		json = !strncmp(req, "json", 4);
+	if(!(f = fdopen(fd, "w"))) {
+		close(fd);
+		return;
+	}
+	snapshot_hist(&request_time, &live.request_time);
+	snapshot_hist(&cycle_time, &live.cycle_time);
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	fprintf(f, json ? "{\"uptime_ms\":%lld" : "uptime_ms %lld\n", ts_diff_ns(&now, &start) / 1000000);
+	for(i = 0; i < NUM_LIVE; i++)
+		fprintf(f, json ? ",\"%s\":%lu" : "%s %lu\n", live_names[i],
+			(unsigned long)atomic_load_explicit(&live.counters[i], memory_order_relaxed));
+	print_hist(f, json, "request_time", &request_time);
+	print_hist(f, json, "cycle_time", &cycle_time);
+	if(json)
+		fputs("}\n", f);
+	fclose(f);
+}
+
+static void *server_main(void *arg)
+{
+	int fd;
+
+	while(1) {
+		if((fd = accept(sock, NULL, NULL)) < 0) {
+			if(errno == EINTR || errno == ECONNABORTED)
+				continue;
+			/* Shut down by live_destroy(). */
+			break;
+		}
+		serve(fd);
+	}
+	return NULL;
+}
+
+int live_init(const char *path)
+{
+	struct sockaddr_un addr = {.sun_family = AF_UNIX};
+	sigset_t block, old;
+	struct stat st;
+	int err;
+
+	if(strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "Socket path too long: %s\n", path);
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+	if((sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0) {
+		perror("socket()");
+		return -1;
+	}
+	/* Replace the socket of an earlier run, but nothing else. */
+	if(!stat(path, &st) && S_ISSOCK(st.st_mode))
+		unlink(path);
+	if(bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(sock, 8) < 0) {
+		perror("Unable to listen on stats socket");
+		goto err;
+	}
+	if(!(sock_path = strdup(path))) {
+		perror("strdup");
+		goto err;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	/* Signals are handled by the main thread. */
+	sigemptyset(&block);
+	sigaddset(&block, SIGINT);
+	sigaddset(&block, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &block, &old);
+	err = pthread_create(&server_thread, NULL, server_main, NULL);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if(err) {
+		fprintf(stderr, "pthread_create(): %s\n", strerror(err));
+		goto err;
+	}
+	serving = enabled = 1;
+	return 0;
+
+err:
+	live_destroy();
+	return -1;
+}
+
+void live_destroy()
+{
+	enabled = 0;
+	if(sock != -1)
+		shutdown(sock, SHUT_RDWR);
+	if(serving)
+		pthread_join(server_thread, NULL);
+	serving = 0;
+	if(sock != -1)
+		close(sock);
+	sock = -1;
+	if(sock_path)
+		unlink(sock_path);
+	free(sock_path);
+	sock_path = NULL;
+}
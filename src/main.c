@@ -11,6 +11,7 @@
 
 #include "options.h"
 #include "getter.h"
+#include "output.h"
 
 static struct options opt;
 
@@ -18,16 +19,12 @@ static struct sigaction sigdfl = {
 	.sa_handler = SIG_DFL,
 };
 
+/* The main loop stops at the next wakeup and tears everything down from
+ * there; a second signal is not caught. */
 static void sig_exit(int signal)
 {
-	kill_workers();
-	if(signal == SIGINT) print_stats(opt.output);
-	destroy_options(&opt);
-	if(signal == SIGINT) {
-		sigaction(SIGINT, &sigdfl, NULL);
-		kill(getpid(), SIGINT);
-	}
-	exit(signal);
+	interrupted = signal;
+	sigaction(signal, &sigdfl, NULL);
 }
 
 static struct sigaction sigact = {
@@ -50,6 +47,12 @@ int main(int argc, char **argv)
 	ret = get_loop(&opt);
 
 	destroy_options(&opt);
+	if(interrupted) {
+		output_flush();
+		if(interrupted == SIGINT)
+			kill(getpid(), SIGINT);
+		exit(interrupted);
+	}
 	return ret;
 
 }
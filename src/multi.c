@@ -0,0 +1,429 @@
+/**
+ * multi.c
+ *
+ * Toke Høiland-Jørgensen
+ * 2026-10-17
+ *
+ * Single-process engine: all transfers are driven from one curl_multi handle
+ * using the socket interface on top of epoll, so the number of workers is the
+ * number of concurrent transfers rather than the number of processes.
+ * A hedged request runs on two transfers, linked through twin until one of
+ * them finishes; hedge is set on the duplicate, and hedged on both.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <curl/curl.h>
+#include "engine.h"
+#include "resolve.h"
+#include "scheduler.h"
+#include "transfer.h"
+#include "util.h"
+
+#define MAX_EVENTS 64
+
+struct multi_transfer {
+	CURL *easy;
+	struct transfer_data td;
+	struct url_list *list;
+	struct curl_slist *headers;
+	struct resolve_list *resolve;
+	struct cycle *cycle;
+	const char *url;
+	int url_idx;
+	int active;
+	struct timespec started;
+	struct timespec issued;
+	struct multi_transfer *twin;
+	int hedge;
+	int hedged;
+};
+
+static struct options *opt;
+static CURLM *multi = NULL;
+static struct multi_transfer *transfers = NULL;
+static int epfd = -1;
+static long timeout_ms = -1;
+static int active = 0;
+static int concurrency = 0;
+static int fresh_connect = 0;
+
+static int socket_callback(CURL *easy, curl_socket_t s, int what, void *userp, void *socketp)
+{
+	struct epoll_event ev = {0};
+
+	if(what == CURL_POLL_REMOVE) {
+		epoll_ctl(epfd, EPOLL_CTL_DEL, s, NULL);
+		return 0;
+	}
+
+	ev.data.fd = s;
+	if(what & CURL_POLL_IN) ev.events |= EPOLLIN;
+	if(what & CURL_POLL_OUT) ev.events |= EPOLLOUT;
+
+	if(epoll_ctl(epfd, EPOLL_CTL_MOD, s, &ev) && errno == ENOENT &&
+	   epoll_ctl(epfd, EPOLL_CTL_ADD, s, &ev)) {
+		perror("epoll_ctl()");
+		return -1;
+	}
+	return 0;
+}
+
+static int timer_callback(CURLM *m, long timeout, void *userp)
+{
+	timeout_ms = timeout;
+	return 0;
+}
+
+static void destroy_transfers()
+{
+	int i;
+	if(!transfers) return;
+	for(i = 0; i < opt->workers; i++) {
+		if(transfers[i].easy) {
+			if(multi) curl_multi_remove_handle(multi, transfers[i].easy);
+			curl_easy_cleanup(transfers[i].easy);
+		}
+		transfer_data_destroy(&transfers[i].td);
+		url_list_put(transfers[i].list);
+		curl_slist_free_all(transfers[i].headers);
+		resolve_put(transfers[i].resolve);
+	}
+	free(transfers);
+	transfers = NULL;
+}
+
+static int init_transfers()
+{
+	int i;
+	transfers = calloc(opt->workers, sizeof(*transfers));
+	if(!transfers) {
+		perror("calloc");
+		return -1;
+	}
+	for(i = 0; i < opt->workers; i++) {
+		transfers[i].easy = curl_easy_init();
+		if(!transfers[i].easy ||
+		   setup_handle(transfers[i].easy, opt, &transfers[i].td) != CURLE_OK ||
+		   curl_easy_setopt(transfers[i].easy, CURLOPT_PRIVATE, &transfers[i]) != CURLE_OK) {
+			fprintf(stderr, "Unable to initialise cURL handle.\n");
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int reset_multi()
+{
+	destroy_transfers();
+	active = 0;
+	if(multi) curl_multi_cleanup(multi);
+	timeout_ms = -1;
+
+	multi = curl_multi_init();
+	if(!multi) {
+		fprintf(stderr, "Unable to initialise cURL multi handle.\n");
+		return -1;
+	}
+	curl_multi_setopt(multi, CURLMOPT_SOCKETFUNCTION, socket_callback);
+	curl_multi_setopt(multi, CURLMOPT_TIMERFUNCTION, timer_callback);
+	/* Only multiplex when asked to, so that the default numbers stay
+	 * comparable to the one-connection-per-worker fork engine. */
+	curl_multi_setopt(multi, CURLMOPT_PIPELINING,
+			  opt->http_version >= HTTP_VERSION_2 ? CURLPIPE_MULTIPLEX : CURLPIPE_NOTHING);
+	return init_transfers();
+}
+
+/* Pin the names resolved up front into the handle, if there are any. */
+static void set_resolve(struct multi_transfer *t)
+{
+	struct resolve_list *list = resolve_get();
+	if(list && (!t->resolve || t->resolve->generation != list->generation)) {
+		curl_easy_setopt(t->easy, CURLOPT_RESOLVE, list->entries);
+		resolve_put(t->resolve);
+		t->resolve = list;
+	} else {
+		resolve_put(list);
+	}
+}
+
+static int start_transfer(struct multi_transfer *t, struct cycle *c, int idx,
+			  struct multi_transfer *orig)
+{
+	CURLMcode mres;
+	t->cycle = c;
+	t->url_idx = idx;
+	t->url = idx == -1 ? c->urls_loc : url_get(c->urls, idx);
+	if(opt->debug) {
+		fprintf(stderr, "Getting URL '%s'.\n", t->url);
+	}
+	if(idx == -1) {
+		if(!(t->list = url_list_new()))
+			return -1;
+		t->td.urls = &t->list->urls;
+		t->headers = list_request_headers(list_cache_etag(), list_cache_last_modified());
+	}
+	curl_easy_setopt(t->easy, CURLOPT_URL, t->url);
+	curl_easy_setopt(t->easy, CURLOPT_HTTPHEADER, t->headers);
+	curl_easy_setopt(t->easy, CURLOPT_FRESH_CONNECT, (long)fresh_connect);
+	set_transfer_timeout(t->easy, opt, deadline_left_ms(&c->deadline));
+	set_resolve(t);
+	transfer_start(&t->td);
+	if((mres = curl_multi_add_handle(multi, t->easy)) != CURLM_OK) {
+		fprintf(stderr, "cURL multi error: %s\n", curl_multi_strerror(mres));
+		return -1;
+	}
+	t->active = 1;
+	active++;
+	clock_gettime(CLOCK_MONOTONIC, &t->started);
+	t->issued = orig ? orig->started : t->started;
+	t->twin = orig;
+	t->hedge = t->hedged = orig != NULL;
+	if(orig) {
+		orig->twin = t;
+		orig->hedged = 1;
+	}
+	return 0;
+}
+
+static void stop_transfer(struct multi_transfer *t)
+{
+	curl_multi_remove_handle(multi, t->easy);
+	t->active = 0;
+	t->cycle = NULL;
+	t->twin = NULL;
+	active--;
+}
+
+static void finish_transfer(struct multi_transfer *t, CURLcode res)
+{
+	struct multi_transfer *twin = t->twin;
+	struct cycle *c = t->cycle;
+	struct result r;
+	struct url_list *list;
+	const char *etag, *last_modified;
+	long code;
+
+	stop_transfer(t);
+
+	/* The first copy of a hedged request to fail leaves it to the other
+	 * one; the first to succeed wins, and the other one is cancelled. */
+	if(twin && res != CURLE_OK && !deadline_passed(&c->deadline)) {
+		twin->twin = NULL;
+		return;
+	}
+	if(twin)
+		stop_transfer(twin);
+
+	result_init(&r);
+	r.url = t->url_idx;
+	r.status = res;
+	r.worker = t - transfers;
+	r.started = t->issued;
+	if(t->hedged)
+		r.hedge = t->hedge ? HEDGE_WON : HEDGE_LOST;
+	if(res == CURLE_OK) {
+		get_result(t->easy, &r);
+		res = transfer_result(&t->td, &r);
+		if(t->hedge)
+			result_delay(&r, ts_diff_ns(&t->started, &t->issued) / 1000);
+	} else if(deadline_missed(&c->deadline, res)) {
+		/* Cut short by the cycle deadline. */
+	} else if(t->url_idx == -1) {
+		fprintf(stderr, "cURL error: '%s' while getting URL list at %s.\n", curl_easy_strerror(res), t->url);
+	} else {
+		fprintf(stderr, "cURL error: %s for URL '%s'.\n", curl_easy_strerror(res), t->url);
+	}
+
+	/* The list was parsed while it streamed in; hand it over to the cycle
+	 * (or reuse the cached one if it was not modified). */
+	if(t->url_idx == -1) {
+		list = t->list;
+		t->list = NULL;
+		t->td.urls = NULL;
+		curl_slist_free_all(t->headers);
+		t->headers = NULL;
+		if(res == CURLE_OK && url_table_finish(&list->urls) == 0) {
+			code = get_list_validators(t->easy, &etag, &last_modified);
+			list = list_cache_update(code, list, etag, last_modified);
+			cycle_set_list(c, list, code == 304 ? LIST_NOT_MODIFIED : LIST_FETCHED);
+		} else {
+			url_list_put(list);
+		}
+	}
+	cycle_add_result(c, &r);
+}
+
+/* Wait for socket activity (or the next cURL timeout, or the caller's
+ * deadline) and let cURL act on it, then finish off completed transfers.
+ * Returns 1 if a signal cut the wait short. */
+static int multi_wait(int wait_ms)
+{
+	struct epoll_event events[MAX_EVENTS];
+	struct multi_transfer *t;
+	CURLMsg *msg;
+	int running, nfds, flags, i, msgs, timeout = timeout_ms;
+
+	if(wait_ms >= 0 && (timeout < 0 || wait_ms < timeout))
+		timeout = wait_ms;
+
+	nfds = epoll_wait(epfd, events, MAX_EVENTS, timeout);
+	if(nfds == -1) {
+		if(errno == EINTR) return 1;
+		perror("epoll_wait()");
+		return -1;
+	}
+	if(nfds == 0) {
+		curl_multi_socket_action(multi, CURL_SOCKET_TIMEOUT, 0, &running);
+	}
+	for(i = 0; i < nfds; i++) {
+		flags = 0;
+		if(events[i].events & EPOLLIN) flags |= CURL_CSELECT_IN;
+		if(events[i].events & EPOLLOUT) flags |= CURL_CSELECT_OUT;
+		if(events[i].events & (EPOLLERR|EPOLLHUP)) flags |= CURL_CSELECT_ERR;
+		curl_multi_socket_action(multi, events[i].data.fd, flags, &running);
+	}
+
+	while((msg = curl_multi_info_read(multi, &msgs))) {
+		if(msg->msg != CURLMSG_DONE) continue;
+		curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **)&t);
+		if(t->active)
+			finish_transfer(t, msg->data.result);
+	}
+	return 0;
+}
+
+/* A request that has been running for longer than its cycle's hedging delay,
+ * and has not been hedged yet. */
+static int hedge_due(struct multi_transfer *t, const struct timespec *now)
+{
+	return t->active && t->url_idx != -1 && !t->hedged &&
+		t->cycle->hedge_ns && !t->cycle->expired &&
+		ts_diff_ns(now, &t->started) >= t->cycle->hedge_ns;
+}
+
+static struct multi_transfer *hedge_target(const struct timespec *now)
+{
+	int i;
+	for(i = 0; i < opt->workers; i++) {
+		if(hedge_due(&transfers[i], now))
+			return &transfers[i];
+	}
+	return NULL;
+}
+
+/* Milliseconds until the next request is due to be hedged (rounded up), or -1
+ * if none is. */
+static int hedge_timeout_ms(const struct timespec *now)
+{
+	struct multi_transfer *t;
+	long long ns, first = -1;
+	int i;
+	for(i = 0; i < opt->workers; i++) {
+		t = &transfers[i];
+		if(!t->active || t->url_idx == -1 || t->hedged || !t->cycle->hedge_ns)
+			continue;
+		ns = max(t->cycle->hedge_ns - ts_diff_ns(now, &t->started), 0);
+		if(first < 0 || ns < first)
+			first = ns;
+	}
+	return first < 0 ? -1 : (first + 999999) / 1000000;
+}
+
+/* Free transfer slots go to requests that are due to be hedged first, then to
+ * new requests. */
+static int multi_poll(const struct timespec *until)
+{
+	struct multi_transfer *orig;
+	struct timespec now;
+	struct cycle *c;
+	int i, idx, ms, hedge_ms, idle, ret;
+
+	do {
+		idle = 0;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		for(i = 0; i < concurrency; i++) {
+			if(transfers[i].active)
+				continue;
+			if((orig = hedge_target(&now))) {
+				c = orig->cycle;
+				idx = orig->url_idx;
+			} else if(!cycle_take(&c, &idx)) {
+				idle = 1;
+				continue;
+			}
+			if(start_transfer(&transfers[i], c, idx, orig))
+				return -1;
+		}
+		if(!active) return 0;
+
+		/* With a transfer to spare, wake up when the next hedge is
+		 * due. */
+		ms = sched_timeout_ms(until);
+		if(ms == 0) return 0;
+		if(idle && (hedge_ms = hedge_timeout_ms(&now)) >= 0 && (ms < 0 || hedge_ms < ms))
+			ms = hedge_ms;
+		if((ret = multi_wait(ms)))
+			return ret < 0 ? -1 : 0;
+	} while(1);
+}
+
+static int multi_start_cycle(struct cycle *c)
+{
+	/* Recreate the multi handle every cycle (dropping its connections)
+	 * unless we are in keep-alive mode. If earlier cycles are still
+	 * running we cannot do that, so use fresh connections instead; except
+	 * when multiplexing, where that would defeat the purpose, so the
+	 * overlapping cycles share connections. */
+	if(!opt->keepalive && !active) {
+		if(reset_multi())
+			return -1;
+		fresh_connect = 0;
+	} else if(!opt->keepalive && opt->http_version < HTTP_VERSION_2) {
+		fresh_connect = 1;
+	}
+	cycle_start(c);
+	return 0;
+}
+
+static int multi_init(struct options *o)
+{
+	opt = o;
+	concurrency = opt->workers;
+	if(curl_global_init(CURL_GLOBAL_DEFAULT) != CURLE_OK) {
+		fprintf(stderr, "Unable to initialise cURL.\n");
+		return -1;
+	}
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	if(epfd == -1) {
+		perror("epoll_create1()");
+		return -1;
+	}
+	return reset_multi();
+}
+
+/* Only the first n transfer slots are started. */
+static void multi_set_concurrency(int n)
+{
+	concurrency = n;
+}
+
+static void multi_destroy()
+{
+	destroy_transfers();
+	if(multi) curl_multi_cleanup(multi);
+	multi = NULL;
+	destroy_share();
+	if(epfd != -1) close(epfd);
+	epfd = -1;
+}
+
+struct engine multi_engine = {
+	.name = "multi",
+	.init = multi_init,
+	.start_cycle = multi_start_cycle,
+	.poll = multi_poll,
+	.set_concurrency = multi_set_concurrency,
+	.destroy = multi_destroy,
+};
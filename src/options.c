@@ -9,7 +9,13 @@
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include "adaptive.h"
+#include "decode.h"
 #include "options.h"
+#include "output.h"
+#include "profile.h"
+#include "sample.h"
+#include "scheduler.h"
 
 int parse_options(struct options *opt, int argc, char **argv);
 
@@ -22,12 +28,34 @@ int initialise_options(struct options *opt, int argc, char **argv)
 	opt->output = stdout;
 	opt->interval = 1000;
 	opt->workers = 4;
+	opt->adapt_mode = ADAPT_NONE;
+	opt->adapt_target = 0;
+	opt->engine = ENGINE_FORK;
+	opt->keepalive = 0;
+	opt->schedule = SCHED_CLOSED;
+	opt->list_refresh = 0;
+	opt->resolve_refresh = -1;
+	opt->url_stats = 0;
+	opt->verify = 0;
+	opt->encodings = NULL;
+	opt->throughput_interval = 0;
+	opt->sample_mode = SAMPLE_NONE;
+	opt->zipf_s = 1.0;
+	opt->sample_count = 0;
+	opt->stats_socket = NULL;
+	opt->trace_out = NULL;
+	opt->replay = NULL;
+	opt->http_version = HTTP_VERSION_DEFAULT;
+	opt->format = FORMAT_TEXT;
 	opt->timeout = 0;
+	opt->deadline = -1;
+	opt->profile = NULL;
+	opt->hedge_delay = 0;
+	opt->hedge_percentile = 0;
 	opt->dns_servers = NULL;
 	opt->ai_family = 0;
 	gettimeofday(&opt->start_time, NULL);
-	opt->urls_l = 0;
-	memset(&opt->urls, 0, MAX_URLS * sizeof(&opt->urls));
+	url_table_init(&opt->urls);
 	opt->urls_loc = NULL;
 
 	if(parse_options(opt, argc, argv) < 0)
@@ -40,18 +68,22 @@ int initialise_options(struct options *opt, int argc, char **argv)
 
 void destroy_options(struct options *opt)
 {
-	int i;
 	if(!opt->initialised)
 		return;
 	opt->initialised = 0;
 	free(opt->dns_servers);
 	free(opt->urls_loc);
-	for(i = 0; i < opt->urls_l; i++) free(opt->urls[i]);
+	free(opt->stats_socket);
+	free(opt->trace_out);
+	free(opt->replay);
+	free(opt->encodings);
+	profile_free(opt->profile);
+	url_table_destroy(&opt->urls);
 }
 
 static void usage(const char *name)
 {
-	fprintf(stderr, "Usage: %s [-46Dh] [-c <count>] [-d <dns_servers>] [-i <interval>] [-l <length>] [-n <workers>] [-o <output>] [-t <timeout>] [url_file]\n", name);
+	fprintf(stderr, "Usage: %s [-46DhkSv] [-A <cycle_time|rate/s>] [-a <closed|fixed|poisson>] [-C <encodings|all>] [-c <count>] [-d <dns_servers>] [-e <fork|multi|thread>] [-F <text|json|binary>] [-g <sample_interval>] [-H <delay|pN>] [-i <interval>] [-l <length>] [-m <requests>] [-n <workers>] [-o <output>] [-p <profile|@file>] [-P <resolve_refresh>] [-r <list_refresh>] [-s <stats_socket>] [-t <timeout>] [-T <deadline>] [-V <1.1|2|2-prior|3>] [-w <trace_out>] [-x <trace>] [-z <uniform|zipf[:s]|weighted>] [url_file]\n", name);
 }
 
 
@@ -60,11 +92,10 @@ int parse_options(struct options *opt, int argc, char **argv)
 	int o;
 	int val;
 	FILE *output, *urlfile;
-	char * line;
-	size_t len = 0;
-	ssize_t read;
+	char *end;
+	int ret;
 
-	while((o = getopt(argc, argv, "46Dhc:d:i:l:n:o:t:")) != -1) {
+	while((o = getopt(argc, argv, "46DhkSvA:a:C:c:d:e:F:g:H:i:l:m:n:o:p:P:r:s:t:T:V:w:x:z:")) != -1) {
 		switch(o) {
 		case '4':
 			opt->ai_family = AF_INET;
@@ -72,6 +103,39 @@ int parse_options(struct options *opt, int argc, char **argv)
 		case '6':
 			opt->ai_family = AF_INET6;
 			break;
+		case 'A':
+			/* A target cycle time in ms, or a request rate. */
+			opt->adapt_target = strtod(optarg, &end);
+			if(strcmp(end, "/s") == 0) {
+				opt->adapt_mode = ADAPT_RATE;
+			} else if(*end == '\0') {
+				opt->adapt_mode = ADAPT_CYCLE_TIME;
+			} else {
+				fprintf(stderr, "Invalid concurrency target: %s\n", optarg);
+				return -1;
+			}
+			if(opt->adapt_target <= 0) {
+				fprintf(stderr, "Invalid concurrency target: %s\n", optarg);
+				return -1;
+			}
+			break;
+		case 'a':
+			if(strcmp(optarg, "closed") == 0) {
+				opt->schedule = SCHED_CLOSED;
+			} else if(strcmp(optarg, "fixed") == 0) {
+				opt->schedule = SCHED_FIXED;
+			} else if(strcmp(optarg, "poisson") == 0) {
+				opt->schedule = SCHED_POISSON;
+			} else {
+				fprintf(stderr, "Invalid arrival mode: %s\n", optarg);
+				return -1;
+			}
+			break;
+		case 'C':
+			free(opt->encodings);
+			if(!(opt->encodings = encodings_accept(optarg)))
+				return -1;
+			break;
 		case 'c':
 			val = atoi(optarg);
 			if(val < 1) {
@@ -91,14 +155,67 @@ int parse_options(struct options *opt, int argc, char **argv)
 			}
 			strcpy(opt->dns_servers, optarg);
 			break;
-		case 'i':
+		case 'e':
+			if(strcmp(optarg, "fork") == 0) {
+				opt->engine = ENGINE_FORK;
+			} else if(strcmp(optarg, "multi") == 0) {
+				opt->engine = ENGINE_MULTI;
+			} else if(strcmp(optarg, "thread") == 0) {
+				opt->engine = ENGINE_THREAD;
+			} else {
+				fprintf(stderr, "Invalid engine: %s\n", optarg);
+				return -1;
+			}
+			break;
+		case 'F':
+			if(strcmp(optarg, "text") == 0) {
+				opt->format = FORMAT_TEXT;
+			} else if(strcmp(optarg, "json") == 0) {
+				opt->format = FORMAT_JSON;
+			} else if(strcmp(optarg, "binary") == 0) {
+				opt->format = FORMAT_BINARY;
+			} else {
+				fprintf(stderr, "Invalid output format: %s\n", optarg);
+				return -1;
+			}
+			break;
+		case 'g':
 			val = atoi(optarg);
 			if(val < 1) {
+				fprintf(stderr, "Invalid goodput sampling interval: %d\n", val);
+				return -1;
+			}
+			opt->throughput_interval = val;
+			break;
+		case 'H':
+			/* A fixed delay in ms, or a percentile of the request
+			 * times seen so far. */
+			if(optarg[0] == 'p') {
+				opt->hedge_percentile = atof(optarg + 1);
+				if(opt->hedge_percentile <= 0 || opt->hedge_percentile >= 100) {
+					fprintf(stderr, "Invalid hedging percentile: %s\n", optarg);
+					return -1;
+				}
+			} else {
+				val = atoi(optarg);
+				if(val < 1) {
+					fprintf(stderr, "Invalid hedging delay: %d\n", val);
+					return -1;
+				}
+				opt->hedge_delay = val;
+			}
+			break;
+		case 'i':
+			val = atoi(optarg);
+			if(val < 0) {
 				fprintf(stderr, "Invalid interval value: %d\n", val);
 				return -1;
 			}
 			opt->interval = val;
 			break;
+		case 'k':
+			opt->keepalive = 1;
+			break;
 		case 'l':
 			val = atoi(optarg);
 			if(val < 1) {
@@ -107,6 +224,14 @@ int parse_options(struct options *opt, int argc, char **argv)
 			}
 			opt->run_length = val;
 			break;
+		case 'm':
+			val = atoi(optarg);
+			if(val < 1) {
+				fprintf(stderr, "Invalid number of requests per cycle: %d\n", val);
+				return -1;
+			}
+			opt->sample_count = val;
+			break;
 		case 'n':
 			val = atoi(optarg);
 			if(val < 1) {
@@ -129,6 +254,40 @@ int parse_options(struct options *opt, int argc, char **argv)
 				opt->output = output;
 			}
 			break;
+		case 'p':
+			if(opt->profile) {
+				fprintf(stderr, "Load profile already set.\n");
+				return -1;
+			}
+			if(!(opt->profile = profile_parse(optarg)))
+				return -1;
+			break;
+		case 'P':
+			val = atoi(optarg);
+			if(val < 0) {
+				fprintf(stderr, "Invalid resolve refresh interval: %d\n", val);
+				return -1;
+			}
+			opt->resolve_refresh = val;
+			break;
+		case 'S':
+			opt->url_stats = 1;
+			break;
+		case 'r':
+			val = atoi(optarg);
+			if(val < 0) {
+				fprintf(stderr, "Invalid list refresh interval: %d\n", val);
+				return -1;
+			}
+			opt->list_refresh = val;
+			break;
+		case 's':
+			free(opt->stats_socket);
+			if(!(opt->stats_socket = strdup(optarg))) {
+				perror("strdup");
+				return -1;
+			}
+			break;
 		case 't':
 			val = atoi(optarg);
 			if(val < 0) {
@@ -137,6 +296,63 @@ int parse_options(struct options *opt, int argc, char **argv)
 			}
 			opt->timeout = val;
 			break;
+		case 'T':
+			val = atoi(optarg);
+			if(val < 0) {
+				fprintf(stderr, "Invalid deadline value: %d\n", val);
+				return -1;
+			}
+			opt->deadline = val;
+			break;
+		case 'V':
+			if(strcmp(optarg, "1.1") == 0) {
+				opt->http_version = HTTP_VERSION_1_1;
+			} else if(strcmp(optarg, "2") == 0) {
+				opt->http_version = HTTP_VERSION_2;
+			} else if(strcmp(optarg, "2-prior") == 0) {
+				opt->http_version = HTTP_VERSION_2_PRIOR;
+			} else if(strcmp(optarg, "3") == 0) {
+				opt->http_version = HTTP_VERSION_3;
+			} else {
+				fprintf(stderr, "Invalid HTTP version: %s\n", optarg);
+				return -1;
+			}
+			break;
+		case 'v':
+			opt->verify = 1;
+			break;
+		case 'w':
+			free(opt->trace_out);
+			if(!(opt->trace_out = strdup(optarg))) {
+				perror("strdup");
+				return -1;
+			}
+			break;
+		case 'x':
+			free(opt->replay);
+			if(!(opt->replay = strdup(optarg))) {
+				perror("strdup");
+				return -1;
+			}
+			break;
+		case 'z':
+			if(strcmp(optarg, "uniform") == 0) {
+				opt->sample_mode = SAMPLE_UNIFORM;
+			} else if(strcmp(optarg, "weighted") == 0) {
+				opt->sample_mode = SAMPLE_WEIGHTED;
+			} else if(strncmp(optarg, "zipf", 4) == 0 &&
+				  (optarg[4] == '\0' || optarg[4] == ':')) {
+				opt->sample_mode = SAMPLE_ZIPF;
+				opt->zipf_s = optarg[4] ? strtod(optarg + 5, &end) : 1.0;
+				if((optarg[4] && *end) || opt->zipf_s <= 0) {
+					fprintf(stderr, "Invalid Zipf exponent: %s\n", optarg);
+					return -1;
+				}
+			} else {
+				fprintf(stderr, "Invalid URL sampling mode: %s\n", optarg);
+				return -1;
+			}
+			break;
 		case 'h':
 		default:
 			usage(argv[0]);
@@ -144,11 +360,56 @@ int parse_options(struct options *opt, int argc, char **argv)
 			break;
 		}
 	}
+	/* A replay follows the timing of the trace, open loop, and has no
+	 * cycles to speak of. */
+	if(opt->replay) {
+		if(opt->profile || opt->adapt_mode != ADAPT_NONE || opt->sample_mode != SAMPLE_NONE ||
+		   opt->sample_count) {
+			fprintf(stderr, "A replay cannot be combined with -p, -A, -m or -z.\n");
+			return -1;
+		}
+		opt->schedule = SCHED_FIXED;
+		if(opt->deadline < 0)
+			opt->deadline = 0;
+	}
+	/* A zero interval runs closed-loop cycles back to back; an open-loop
+	 * schedule needs a rate. */
+	if(opt->interval == 0 && opt->schedule != SCHED_CLOSED && !opt->replay &&
+	   !(opt->profile && opt->profile->has_rate)) {
+		fprintf(stderr, "Invalid interval value for open-loop arrivals: 0\n");
+		return -1;
+	}
+	/* Names are resolved up front with the system resolver, which knows
+	 * nothing of the servers given to cURL. */
+	if(opt->resolve_refresh >= 0 && opt->dns_servers) {
+		fprintf(stderr, "DNS pre-resolution cannot be combined with -d.\n");
+		return -1;
+	}
+	if((opt->hedge_delay || opt->hedge_percentile) && opt->engine == ENGINE_THREAD) {
+		fprintf(stderr, "Hedging is not supported by the thread engine.\n");
+		return -1;
+	}
+	if(opt->profile && opt->profile->has_conc && opt->adapt_mode != ADAPT_NONE) {
+		fprintf(stderr, "A concurrency profile cannot be combined with -A.\n");
+		return -1;
+	}
+	/* A number of requests per cycle is drawn uniformly unless told
+	 * otherwise. */
+	if(opt->sample_count && opt->sample_mode == SAMPLE_NONE)
+		opt->sample_mode = SAMPLE_UNIFORM;
+	/* Unless set explicitly, a cycle has to be done by the time the next
+	 * one is due; with a rate profile, that changes as it goes. */
+	if(opt->deadline < 0 && !(opt->profile && opt->profile->has_rate))
+		opt->deadline = opt->interval;
 	if(optind >= argc || strcmp(argv[optind], "-") == 0) {
 		urlfile = stdin;
 	} else {
 		if(strncmp(argv[optind], "http://", 7) == 0 ||
 			strncmp(argv[optind], "https://", 8) == 0) {
+			if(opt->replay) {
+				fprintf(stderr, "A replay needs the URL file the trace refers to.\n");
+				return -1;
+			}
 			opt->urls_loc = malloc(strlen(argv[optind])+1);
 			strcpy(opt->urls_loc, argv[optind]);
 			return 0;
@@ -160,19 +421,10 @@ int parse_options(struct options *opt, int argc, char **argv)
 		}
 	}
 
-	while((read = getline(&line, &len, urlfile)) != -1) {
-		if(opt->urls_l >= MAX_URLS) {
-			fprintf(stderr, "Max number of urls (%d) exceeded.\n", MAX_URLS);
-			return -1;
-		}
-		if(*line == '#') continue;
-		opt->urls[opt->urls_l] = malloc(len);
-		memcpy(opt->urls[opt->urls_l], line, read);
-		opt->urls[opt->urls_l][read-1] = '\0';
-		opt->urls_l++;
-	}
-	free(line);
+	ret = url_table_load(&opt->urls, urlfile);
 	fclose(urlfile);
+	if(ret < 0)
+		return -1;
 
 	return 0;
 }
@@ -0,0 +1,237 @@
+/**
+ * output.c
+ *
+ * Toke Høiland-Jørgensen
+ * 2026-10-17
+ */
+
+#include <string.h>
+#include <sys/time.h>
+#include "output.h"
+#include "decode.h"
+#include "util.h"
+
+#define OUTPUT_BUFSIZE (1 << 20)
+
+static const char *list_status_names[] = {
+	[LIST_FETCHED] = "fetched",
+	[LIST_NOT_MODIFIED] = "not_modified",
+	[LIST_CACHED] = "cached",
+};
+
+static const char *time_names[NUM_TIMES] = {
+	[TIME_NAMELOOKUP] = "namelookup_us",
+	[TIME_CONNECT] = "connect_us",
+	[TIME_APPCONNECT] = "appconnect_us",
+	[TIME_STARTTRANSFER] = "starttransfer_us",
+	[TIME_TOTAL] = "total_us",
+};
+
+static FILE *output = NULL;
+static int format = FORMAT_TEXT;
+static int verifying = 0, decoding = 0, goodput = 0;
+static char buffer[OUTPUT_BUFSIZE];
+
+static int64_t now_us()
+{
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	return (int64_t)now.tv_sec * 1000000 + now.tv_usec;
+}
+
+static void write_record(struct record *rec)
+{
+	fwrite(rec, sizeof(*rec), 1, output);
+}
+
+/* Must be called before anything else is written to f. The digest, content
+ * encoding and goodput fields are only written to JSON records with -v, -C and
+ * -g. */
+int output_init(FILE *f, int fmt, int verify, int decode, int sample)
+{
+	struct record rec;
+
+	output = f;
+	format = fmt;
+	verifying = verify;
+	decoding = decode;
+	goodput = sample;
+	if(format == FORMAT_TEXT)
+		return 0;
+
+	if(setvbuf(output, buffer, _IOFBF, sizeof(buffer))) {
+		perror("setvbuf()");
+		return -1;
+	}
+	if(format == FORMAT_BINARY) {
+		memset(&rec, 0, sizeof(rec));
+		rec.type = RECORD_HEADER;
+		rec.cycle = -1;
+		rec.u.header.magic = RECORD_MAGIC;
+		rec.u.header.version = RECORD_VERSION;
+		rec.u.header.size = sizeof(rec);
+		rec.u.header.start = now_us();
+		write_record(&rec);
+	}
+	return 0;
+}
+
+void output_request(const struct cycle *c, const struct result *r)
+{
+	struct record rec;
+	int i;
+
+	switch(format) {
+	case FORMAT_JSON:
+		fprintf(output, "{\"type\":\"request\",\"cycle\":%d,\"url\":%d,\"status\":%d,\"code\":%ld,\"bytes\":%ld,\"connects\":%ld,\"hedge\":%d",
+			c->id, r->url, r->status, r->code, r->bytes, r->connects, r->hedge);
+		if(verifying)
+			fprintf(output, ",\"crc32c\":\"%08x\",\"verify\":%d", r->digest, r->verify);
+		if(decoding)
+			fprintf(output, ",\"encoding\":\"%s\",\"wire_bytes\":%ld,\"decoded_bytes\":%ld,\"decode_ns\":%lld",
+				encoding_name(r->encoding), r->wire_bytes, r->decoded_bytes, r->decode_ns);
+		if(goodput) {
+			fprintf(output, ",\"samples\":%d,\"stalls\":%d,\"body_ns\":%lld,\"ramp_ns\":%lld,\"stall_ns\":%lld,\"peak_rate\":%ld,\"curve\":[",
+				r->samples, r->stalls, r->body_ns, r->ramp_ns, r->stall_ns, r->peak_rate);
+			for(i = 0; i < CURVE_WINDOWS; i++)
+				fprintf(output, i ? ",%ld" : "%ld", r->curve[i]);
+			fputc(']', output);
+		}
+		for(i = 0; i < NUM_TIMES; i++)
+			fprintf(output, ",\"%s\":%ld", time_names[i], (long)r->times[i]);
+		fputs("}\n", output);
+		break;
+	case FORMAT_BINARY:
+		memset(&rec, 0, sizeof(rec));
+		rec.type = RECORD_REQUEST;
+		rec.cycle = c->id;
+		rec.u.request.url = r->url;
+		rec.u.request.status = r->status;
+		rec.u.request.code = r->code;
+		rec.u.request.connects = r->connects;
+		rec.u.request.hedge = r->hedge;
+		rec.u.request.verify = r->verify;
+		rec.u.request.digest = r->digest;
+		rec.u.request.encoding = r->encoding;
+		rec.u.request.wire_bytes = r->wire_bytes;
+		rec.u.request.decoded_bytes = r->decoded_bytes;
+		rec.u.request.decode_ns = r->decode_ns;
+		rec.u.request.samples = r->samples;
+		rec.u.request.stalls = r->stalls;
+		rec.u.request.body_ns = r->body_ns;
+		rec.u.request.ramp_ns = r->ramp_ns;
+		rec.u.request.stall_ns = r->stall_ns;
+		rec.u.request.peak_rate = r->peak_rate;
+		rec.u.request.bytes = r->bytes;
+		for(i = 0; i < NUM_TIMES; i++)
+			rec.u.request.times[i] = r->times[i];
+		write_record(&rec);
+		break;
+	}
+}
+
+void output_cycle(const struct cycle *c, long long duration_ns, long long lag_ns)
+{
+	struct record rec;
+
+	switch(format) {
+	case FORMAT_JSON:
+		fprintf(output, "{\"type\":\"cycle\",\"cycle\":%d,\"timestamp_us\":%lld,\"status\":%d,\"requests\":%d,\"errors\":%d,\"missed\":%d,\"hedged\":%d,\"hedge_wins\":%d,\"concurrency\":%d,\"bytes\":%ld,\"connects\":%ld,\"duration_us\":%lld,\"lag_us\":%lld",
+			c->id, (long long)now_us(), c->err, c->stats.requests, c->stats.errors, c->stats.missed, c->stats.hedged, c->stats.hedge_wins, c->concurrency, c->bytes,
+			c->stats.connects, duration_ns / 1000, lag_ns / 1000);
+		if(c->urls_loc)
+			fprintf(output, ",\"list\":\"%s\",\"list_us\":%ld",
+				list_status_names[c->list_status], (long)c->list_time);
+		fputs("}\n", output);
+		break;
+	case FORMAT_BINARY:
+		memset(&rec, 0, sizeof(rec));
+		rec.type = RECORD_CYCLE;
+		rec.cycle = c->id;
+		rec.u.cycle.status = c->err;
+		rec.u.cycle.requests = c->stats.requests;
+		rec.u.cycle.errors = c->stats.errors;
+		rec.u.cycle.list_status = c->urls_loc ? c->list_status : -1;
+		rec.u.cycle.missed = c->stats.missed;
+		rec.u.cycle.hedged = c->stats.hedged;
+		rec.u.cycle.hedge_wins = c->stats.hedge_wins;
+		rec.u.cycle.concurrency = c->concurrency;
+		rec.u.cycle.bytes = c->bytes;
+		rec.u.cycle.connects = c->stats.connects;
+		rec.u.cycle.timestamp = now_us();
+		rec.u.cycle.duration = duration_ns / 1000;
+		rec.u.cycle.lag = lag_ns / 1000;
+		rec.u.cycle.list_time = c->list_time;
+		write_record(&rec);
+		break;
+	}
+}
+
+/* URLs can hold characters that need escaping in a JSON string. */
+static void json_string(const char *s)
+{
+	fputc('"', output);
+	for(; *s; s++) {
+		if(*s == '"' || *s == '\\')
+			fprintf(output, "\\%c", *s);
+		else if((unsigned char)*s < 0x20)
+			fprintf(output, "\\u%04x", *s);
+		else
+			fputc(*s, output);
+	}
+	fputc('"', output);
+}
+
+static void output_stats(int type, int url, const char *name, int host, const struct url_stats *s)
+{
+	struct record rec;
+	int64_t avg = s->time_sum / max(s->requests, 1);
+
+	switch(format) {
+	case FORMAT_JSON:
+		if(type == RECORD_URL)
+			fprintf(output, "{\"type\":\"url\",\"url\":%d,\"host\":%d,\"name\":", url, host);
+		else
+			fprintf(output, "{\"type\":\"host\",\"host\":%d,\"name\":", host);
+		json_string(name);
+		fprintf(output, ",\"requests\":%u,\"errors\":%u,\"bytes\":%lu,\"avg_us\":%ld,\"p50_us\":%lu,\"p90_us\":%lu,\"p99_us\":%lu,\"max_us\":%lu}\n",
+			s->requests, s->errors, (unsigned long)s->bytes, (long)avg,
+			(unsigned long)chist_percentile(&s->hist, 50),
+			(unsigned long)chist_percentile(&s->hist, 90),
+			(unsigned long)chist_percentile(&s->hist, 99),
+			(unsigned long)s->hist.max);
+		break;
+	case FORMAT_BINARY:
+		memset(&rec, 0, sizeof(rec));
+		rec.type = type;
+		rec.cycle = -1;
+		rec.u.stats.url = url;
+		rec.u.stats.host = host;
+		rec.u.stats.requests = s->requests;
+		rec.u.stats.errors = s->errors;
+		rec.u.stats.bytes = s->bytes;
+		rec.u.stats.avg = avg;
+		rec.u.stats.p50 = chist_percentile(&s->hist, 50);
+		rec.u.stats.p90 = chist_percentile(&s->hist, 90);
+		rec.u.stats.p99 = chist_percentile(&s->hist, 99);
+		rec.u.stats.max = s->hist.max;
+		write_record(&rec);
+		break;
+	}
+}
+
+void output_host_stats(int host, const char *name, const struct url_stats *s)
+{
+	output_stats(RECORD_HOST, -1, name, host, s);
+}
+
+void output_url_stats(int url, const char *name, int host, const struct url_stats *s)
+{
+	output_stats(RECORD_URL, url, name, host, s);
+}
+
+void output_flush()
+{
+	if(output)
+		fflush(output);
+}
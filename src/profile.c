@@ -0,0 +1,340 @@
+/**
+ * profile.c
+ *
+ * Toke Høiland-Jørgensen
+ * 2026-10-17
+ *
+ * Load profiles, and finding the saturation knee in the results. The knee is
+ * the first level where more than KNEE_ERROR_RATE of the requests fail, where
+ * a cycle misses its deadline, or where the request time p99 exceeds
+ * KNEE_LATENCY_FACTOR times the best p99 of the levels before it in the same
+ * stage, and by at least KNEE_LATENCY_DELTA. Only levels with KNEE_MIN_REQUESTS
+ * requests have a p99 worth comparing. A rate that cannot be kept up shows as
+ * missed deadlines, since the deadline defaults to the interval between
+ * cycles.
+ */
+
+#include <ctype.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "profile.h"
+#include "util.h"
+
+#define PROFILE_RAMP_LEVELS 10
+#define KNEE_LATENCY_FACTOR 2.0
+#define KNEE_LATENCY_DELTA 1000 /* us */
+#define KNEE_MIN_REQUESTS 100
+#define KNEE_ERROR_RATE 0.01
+
+static const char *kind_names[] = {
+	[PROFILE_RATE] = "rate",
+	[PROFILE_CONC] = "conc",
+};
+
+static char *strip(char *s)
+{
+	char *end;
+	while(isspace((unsigned char)*s))
+		s++;
+	end = s + strlen(s);
+	while(end > s && isspace((unsigned char)end[-1]))
+		*--end = '\0';
+	return s;
+}
+
+static int parse_stage(struct profile_stage *st, char *s)
+{
+	double secs;
+	char *p;
+
+	memset(st, 0, sizeof(*st));
+	if(!strncmp(s, "rate:", 5))
+		st->kind = PROFILE_RATE;
+	else if(!strncmp(s, "conc:", 5))
+		st->kind = PROFILE_CONC;
+	else
+		return -1;
+	st->from = st->to = strtod(s + 5, &p);
+	if(*p == '-')
+		st->to = strtod(p + 1, &p);
+	if(*p == '/' && (st->steps = strtol(p + 1, &p, 10)) < 2)
+		return -1;
+	if(*p != ':')
+		return -1;
+	secs = strtod(p + 1, &p);
+	if(*p || secs <= 0 || st->from <= 0 || st->to <= 0 ||
+	   (st->kind == PROFILE_CONC && (st->from < 1 || st->to < 1)))
+		return -1;
+	st->duration_ns = secs * NSEC_PER_SEC;
+	return 0;
+}
+
+static int add_stage(struct profile *p, char *s)
+{
+	struct profile_stage *st;
+
+	s = strip(s);
+	if(!*s || *s == '#')
+		return 0;
+	if(!(st = realloc(p->stages, (p->nstages + 1) * sizeof(*st)))) {
+		perror("realloc");
+		return -1;
+	}
+	p->stages = st;
+	if(parse_stage(&p->stages[p->nstages], s)) {
+		fprintf(stderr, "Invalid profile stage: %s\n", s);
+		return -1;
+	}
+	if(p->stages[p->nstages].kind == PROFILE_RATE)
+		p->has_rate = 1;
+	else
+		p->has_conc = 1;
+	p->nstages++;
+	return 0;
+}
+
+/* The stages are given inline, or (with a leading @) in a file. */
+struct profile *profile_parse(const char *spec)
+{
+	struct profile *p;
+	char *copy = NULL, *s, *save, line[256];
+	FILE *f = NULL;
+
+	if(!(p = calloc(1, sizeof(*p)))) {
+		perror("calloc");
+		return NULL;
+	}
+	if(spec[0] == '@') {
+		if(!(f = fopen(spec + 1, "r"))) {
+			perror("Unable to open profile");
+			goto err;
+		}
+		while(fgets(line, sizeof(line), f)) {
+			if(add_stage(p, line))
+				goto err;
+		}
+		fclose(f);
+		f = NULL;
+	} else {
+		if(!(copy = strdup(spec))) {
+			perror("strdup");
+			goto err;
+		}
+		for(s = strtok_r(copy, ",", &save); s; s = strtok_r(NULL, ",", &save)) {
+			if(add_stage(p, s))
+				goto err;
+		}
+		free(copy);
+		copy = NULL;
+	}
+	if(!p->nstages) {
+		fprintf(stderr, "Empty load profile.\n");
+		goto err;
+	}
+	return p;
+
+err:
+	if(f) fclose(f);
+	free(copy);
+	profile_free(p);
+	return NULL;
+}
+
+void profile_free(struct profile *p)
+{
+	if(!p)
+		return;
+	free(p->stages);
+	free(p->levels);
+	free(p);
+}
+
+void profile_start(struct profile *p, const struct timespec *now, int max_conc)
+{
+	p->start = p->level_start = *now;
+	p->stage = 0;
+	p->max_conc = max_conc;
+}
+
+static int stage_levels(const struct profile_stage *st)
+{
+	if(st->steps)
+		return st->steps;
+	return st->from == st->to ? 1 : PROFILE_RAMP_LEVELS;
+}
+
+/* The value at fraction pos of a stage, and the load of the level it is in. */
+static double stage_value(const struct profile_stage *st, double pos, int *level, double *load)
+{
+	int n = stage_levels(st);
+
+	*level = min((int)(pos * n), n - 1);
+	if(st->steps) {
+		*load = st->from + (st->to - st->from) * *level / (n - 1);
+		return *load;
+	}
+	*load = st->from + (st->to - st->from) * (*level + 0.5) / n;
+	return st->from + (st->to - st->from) * pos;
+}
+
+static int open_level(struct profile *p, const struct timespec *now, int index, int next_cycle, double load)
+{
+	struct profile_level *l;
+
+	if(p->nlevels)
+		p->levels[p->nlevels-1].elapsed_ns = ts_diff_ns(now, &p->level_start);
+	if(!(l = realloc(p->levels, (p->nlevels + 1) * sizeof(*l)))) {
+		perror("realloc");
+		return -1;
+	}
+	p->levels = l;
+	l = &p->levels[p->nlevels++];
+	memset(l, 0, sizeof(*l));
+	l->index = index;
+	l->stage = p->stage;
+	l->load = load;
+	l->first_cycle = next_cycle;
+	p->level_start = *now;
+	return 0;
+}
+
+/* Where the profile is at now, for the cycle about to be started: sets the
+ * rate or the concurrency (whichever the current stage is about), and returns
+ * 0 once the profile is over. */
+int profile_next(struct profile *p, const struct timespec *now, int next_cycle,
+		 double *rate, double *conc)
+{
+	const struct profile_stage *st;
+	long long offset = ts_diff_ns(now, &p->start);
+	double value, load;
+	int i, level, base = 0;
+
+	for(i = 0; i < p->nstages && offset >= p->stages[i].duration_ns; i++) {
+		offset -= p->stages[i].duration_ns;
+		base += stage_levels(&p->stages[i]);
+	}
+	if(i == p->nstages) {
+		if(p->nlevels && !p->levels[p->nlevels-1].elapsed_ns)
+			p->levels[p->nlevels-1].elapsed_ns = ts_diff_ns(now, &p->level_start);
+		return 0;
+	}
+	st = &p->stages[i];
+	p->stage = i;
+	value = stage_value(st, (double)offset / st->duration_ns, &level, &load);
+	/* A concurrency holds at the whole number a level is labelled with,
+	 * for as long as the level lasts. */
+	if(st->kind == PROFILE_CONC)
+		value = load = max(1, min((int)lround(load), p->max_conc));
+	/* Levels that passed without a cycle starting are skipped. */
+	if((!p->nlevels || p->levels[p->nlevels-1].index != base + level) &&
+	   open_level(p, now, base + level, next_cycle, load))
+		return 0;
+	*(st->kind == PROFILE_RATE ? rate : conc) = value;
+	return 1;
+}
+
+static struct profile_level *find_level(struct profile *p, int cycle)
+{
+	int i;
+	for(i = p->nlevels - 1; i >= 0; i--) {
+		if(p->levels[i].first_cycle <= cycle)
+			return &p->levels[i];
+	}
+	return NULL;
+}
+
+/* A transfer cut short by the deadline is counted with the missed cycles, not
+ * as an error. */
+void profile_add_result(struct profile *p, const struct cycle *c, const struct result *r)
+{
+	struct profile_level *l;
+
+	if(r->url < 0 || deadline_missed(&c->deadline, r->status) || !(l = find_level(p, c->id)))
+		return;
+	if(r->status) {
+		l->errors++;
+		return;
+	}
+	l->requests++;
+	chist_record(&l->hist, r->times[TIME_TOTAL]);
+}
+
+void profile_add_cycle(struct profile *p, int cycle, int missed)
+{
+	struct profile_level *l;
+
+	if(!(l = find_level(p, cycle)))
+		return;
+	l->cycles++;
+	if(missed)
+		l->missed++;
+}
+
+static const char *knee_reason(const struct profile_level *l, uint64_t best_p99, char *buf, size_t len)
+{
+	uint64_t p99 = chist_percentile(&l->hist, 99);
+	uint32_t total = l->requests + l->errors;
+
+	if(total && (double)l->errors / total > KNEE_ERROR_RATE) {
+		snprintf(buf, len, "%.1f%% of requests failed", 100.0 * l->errors / total);
+	} else if(l->missed) {
+		snprintf(buf, len, "%d of %d cycles missed their deadline", l->missed, l->cycles);
+	} else if(best_p99 && l->requests >= KNEE_MIN_REQUESTS &&
+		  p99 > KNEE_LATENCY_FACTOR * best_p99 && p99 - best_p99 >= KNEE_LATENCY_DELTA) {
+		snprintf(buf, len, "request time p99 %.3f ms against %.3f ms at lower load",
+			 (double)p99 / 1000, (double)best_p99 / 1000);
+	} else {
+		return NULL;
+	}
+	return buf;
+}
+
+/* Concurrency levels are whole numbers. */
+static int load_precision(const struct profile *p, const struct profile_level *l)
+{
+	return p->stages[l->stage].kind == PROFILE_CONC ? 0 : 1;
+}
+
+/* A line per level, then the knee (if any). */
+void profile_print(struct profile *p, FILE *output)
+{
+	const struct profile_level *l, *knee = NULL;
+	const char *reason = NULL;
+	char buf[128];
+	uint64_t best_p99 = 0;
+	struct timespec now;
+	int i;
+
+	/* The run may have been stopped before the profile was over. */
+	if(p->nlevels && !p->levels[p->nlevels-1].elapsed_ns) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		p->levels[p->nlevels-1].elapsed_ns = ts_diff_ns(&now, &p->level_start);
+	}
+
+	fprintf(output, "\nLoad profile levels:\n  %5s %4s %9s %7s %9s %7s %10s %9s %9s\n",
+		"level", "kind", "load", "cycles", "requests", "errors", "req/s", "p50 ms", "p99 ms");
+	for(i = 0; i < p->nlevels; i++) {
+		l = &p->levels[i];
+		if(i && l->stage != p->levels[i-1].stage)
+			best_p99 = 0;
+		fprintf(output, "  %5d %4s %9.*f %7d %9u %7u %10.1f %9.3f %9.3f\n", l->index,
+			kind_names[p->stages[l->stage].kind], load_precision(p, l), l->load,
+			l->cycles, l->requests, l->errors,
+			l->elapsed_ns ? l->requests / (l->elapsed_ns / 1e9) : 0.0,
+			(double)chist_percentile(&l->hist, 50) / 1000,
+			(double)chist_percentile(&l->hist, 99) / 1000);
+		if(!knee && (reason = knee_reason(l, best_p99, buf, sizeof(buf))))
+			knee = l;
+		if(l->requests >= KNEE_MIN_REQUESTS && (!best_p99 || chist_percentile(&l->hist, 99) < best_p99))
+			best_p99 = chist_percentile(&l->hist, 99);
+	}
+	if(knee)
+		fprintf(output, "Saturation knee at level %d (%s %.*f): %s.\n", knee->index,
+			kind_names[p->stages[knee->stage].kind], load_precision(p, knee), knee->load,
+			reason);
+	else if(p->nlevels)
+		fprintf(output, "No saturation knee found up to %s %.*f.\n",
+			kind_names[p->stages[p->levels[p->nlevels-1].stage].kind],
+			load_precision(p, &p->levels[p->nlevels-1]), p->levels[p->nlevels-1].load);
+}
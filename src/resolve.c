@@ -0,0 +1,494 @@
+/**
+ * resolve.c
+ *
+ * Toke Høiland-Jørgensen
+ * 2026-10-17
+ *
+ * Up-front DNS resolution. The host names in the URL table are looked up all
+ * at once with getaddrinfo_a(), and the answers are pinned into the transfer
+ * handles with CURLOPT_RESOLVE, so that cycles never wait for DNS. With a
+ * refresh interval the names are looked up again on a helper thread, which
+ * the main loop picks the result up from once it is done. The names of a
+ * fetched URL list are picked up as each new list arrives, and the ones not
+ * seen before are looked up the same way straight away; until then, the
+ * requests for them resolve as they otherwise would.
+ */
+
+#define _GNU_SOURCE
+#include <netdb.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include "resolve.h"
+#include "util.h"
+
+struct resolve_host {
+	char *name;
+	struct addrinfo hints;
+	struct gaicb req;
+	long long time_ns;
+	int err;
+	char *addrs;
+};
+
+/* Names refer to their host by index, as the hosts are added to as new
+ * names come in. */
+struct resolve_name {
+	char *host;
+	long port;
+	int h;
+};
+
+static struct resolve_host *hosts = NULL;
+static struct resolve_name *names = NULL, *pending = NULL;
+static int nhosts = 0, nnames = 0, npending = 0;
+static int ai_family = AF_UNSPEC;
+static struct table_ref ref = TABLE_REF_INIT;
+static struct resolve_list *current = NULL;
+static unsigned int generation = 0;
+static struct histogram *resolve_hist = NULL;
+static long long refresh_ns = 0;
+static struct timespec next_refresh;
+static pthread_t refresh_thread;
+static int refreshing = 0;
+static atomic_int refresh_done;
+
+static int name_cmp(const void *a, const void *b)
+{
+	const struct resolve_name *na = a, *nb = b;
+	int ret = strcmp(na->host, nb->host);
+	if(ret)
+		return ret;
+	return (na->port > nb->port) - (na->port < nb->port);
+}
+
+/* IP literals need no resolving. */
+static int is_address(const char *host)
+{
+	unsigned char buf[sizeof(struct in6_addr)];
+	return host[0] == '[' || inet_pton(AF_INET, host, buf) == 1;
+}
+
+/* Add the host:port of a URL to a list of names. */
+static int add_name(CURLU *u, const char *url, struct resolve_name **list, int *count)
+{
+	struct resolve_name *n;
+	char *host = NULL, *port = NULL;
+
+	if(curl_url_set(u, CURLUPART_URL, url, 0) != CURLUE_OK ||
+	   curl_url_get(u, CURLUPART_HOST, &host, 0) != CURLUE_OK ||
+	   curl_url_get(u, CURLUPART_PORT, &port, CURLU_DEFAULT_PORT) != CURLUE_OK ||
+	   is_address(host)) {
+		curl_free(host);
+		curl_free(port);
+		return 0;
+	}
+	if(*count % 64 == 0) {
+		n = realloc(*list, (*count + 64) * sizeof(**list));
+		if(!n) {
+			perror("realloc");
+			curl_free(host);
+			curl_free(port);
+			return -1;
+		}
+		*list = n;
+	}
+	n = &(*list)[(*count)++];
+	n->host = strdup(host);
+	n->port = atol(port);
+	n->h = -1;
+	curl_free(host);
+	curl_free(port);
+	if(!n->host) {
+		perror("strdup");
+		(*count)--;
+		return -1;
+	}
+	return 0;
+}
+
+static int add_host(const char *name)
+{
+	struct resolve_host *h;
+
+	if(nhosts % 64 == 0) {
+		if(!(h = realloc(hosts, (nhosts + 64) * sizeof(*hosts)))) {
+			perror("realloc");
+			return -1;
+		}
+		hosts = h;
+	}
+	h = &hosts[nhosts];
+	memset(h, 0, sizeof(*h));
+	h->name = (char *)name;
+	h->hints.ai_family = ai_family;
+	h->hints.ai_socktype = SOCK_STREAM;
+	return nhosts++;
+}
+
+/* Sort the names and drop the duplicates, then give each name that has no
+ * host yet that of the other ports of the same name, or a new one. Hosts are
+ * never taken away, so they keep their answers. */
+static int index_names()
+{
+	struct resolve_name tmp;
+	int i, j, k;
+
+	qsort(names, nnames, sizeof(*names), name_cmp);
+	for(j = k = 0; j < nnames; j++) {
+		if(k && !name_cmp(&names[j], &names[k-1])) {
+			if(names[k-1].h < 0) {
+				tmp = names[k-1];
+				names[k-1] = names[j];
+				names[j] = tmp;
+			}
+			free(names[j].host);
+			continue;
+		}
+		names[k++] = names[j];
+	}
+	nnames = k;
+
+	for(i = 0; i < nnames; i++) {
+		if(names[i].h >= 0)
+			continue;
+		if(i && !strcmp(names[i-1].host, names[i].host)) {
+			names[i].h = names[i-1].h;
+			continue;
+		}
+		for(j = i + 1; j < nnames && names[j].h < 0 && !strcmp(names[j].host, names[i].host); j++);
+		if(j < nnames && names[j].h >= 0 && !strcmp(names[j].host, names[i].host))
+			names[i].h = names[j].h;
+		else if((names[i].h = add_host(names[i].host)) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+/* Collect the unique host:port pairs of the URLs, and the unique hosts among
+ * them. */
+static int collect_names(struct options *opt)
+{
+	CURLU *u;
+	size_t i;
+
+	if(!(u = curl_url())) {
+		fprintf(stderr, "Unable to allocate cURL URL handle.\n");
+		return -1;
+	}
+	for(i = 0; i < opt->urls.count; i++) {
+		if(add_name(u, url_get(&opt->urls, i), &names, &nnames))
+			goto err;
+	}
+	if(opt->urls_loc && add_name(u, opt->urls_loc, &names, &nnames))
+		goto err;
+	curl_url_cleanup(u);
+	return index_names();
+
+err:
+	curl_url_cleanup(u);
+	return -1;
+}
+
+/* Move the names waiting to be looked up over to the others. */
+static int merge_pending()
+{
+	int i;
+
+	for(i = 0; i < npending; i++) {
+		if(nnames % 64 == 0) {
+			struct resolve_name *n = realloc(names, (nnames + 64) * sizeof(*names));
+			if(!n) {
+				perror("realloc");
+				goto err;
+			}
+			names = n;
+		}
+		names[nnames++] = pending[i];
+	}
+	npending = 0;
+	return index_names();
+
+err:
+	for(; i < npending; i++)
+		free(pending[i].host);
+	npending = 0;
+	return -1;
+}
+
+/* Addresses as CURLOPT_RESOLVE wants them: comma-separated, IPv6 in
+ * brackets. NULL if there are none of a family we can use, as an empty entry
+ * would not pin anything. */
+static char *format_addrs(const struct addrinfo *ai)
+{
+	char addr[INET6_ADDRSTRLEN], *buf, *p;
+	size_t len = 1;
+	const struct addrinfo *a;
+
+	for(a = ai; a; a = a->ai_next)
+		len += INET6_ADDRSTRLEN + 3;
+	if(!(buf = p = malloc(len))) {
+		perror("malloc");
+		return NULL;
+	}
+	*p = '\0';
+	for(a = ai; a; a = a->ai_next) {
+		if(a->ai_family == AF_INET)
+			inet_ntop(AF_INET, &((struct sockaddr_in *)a->ai_addr)->sin_addr, addr, sizeof(addr));
+		else if(a->ai_family == AF_INET6)
+			inet_ntop(AF_INET6, &((struct sockaddr_in6 *)a->ai_addr)->sin6_addr, addr, sizeof(addr));
+		else
+			continue;
+		p += sprintf(p, a->ai_family == AF_INET6 ? "%s[%s]" : "%s%s", p == buf ? "" : ",", addr);
+	}
+	if(p == buf) {
+		free(buf);
+		return NULL;
+	}
+	return buf;
+}
+
+/* Look up all the hosts in parallel, timing each lookup. A host that fails,
+ * or gets no usable addresses back, keeps the addresses it had. */
+static void resolve_hosts()
+{
+	struct gaicb **list;
+	struct timespec start, now;
+	char *addrs;
+	int i, left, err;
+
+	if(!nhosts)
+		return;
+	if(!(list = malloc(nhosts * sizeof(*list)))) {
+		perror("malloc");
+		return;
+	}
+	for(i = 0; i < nhosts; i++) {
+		memset(&hosts[i].req, 0, sizeof(hosts[i].req));
+		hosts[i].req.ar_name = hosts[i].name;
+		hosts[i].req.ar_request = &hosts[i].hints;
+		list[i] = &hosts[i].req;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if((err = getaddrinfo_a(GAI_NOWAIT, list, nhosts, NULL))) {
+		fprintf(stderr, "getaddrinfo_a(): %s\n", gai_strerror(err));
+		free(list);
+		return;
+	}
+
+	/* Finished requests are taken out of the list, which gai_suspend()
+	 * skips NULL entries of. */
+	for(left = nhosts; left;) {
+		gai_suspend((const struct gaicb * const *)list, nhosts, NULL);
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		for(i = 0; i < nhosts; i++) {
+			if(!list[i] || (err = gai_error(list[i])) == EAI_INPROGRESS)
+				continue;
+			list[i] = NULL;
+			left--;
+			hosts[i].time_ns = ts_diff_ns(&now, &start);
+			hosts[i].err = err;
+			if(!err && (addrs = format_addrs(hosts[i].req.ar_result))) {
+				free(hosts[i].addrs);
+				hosts[i].addrs = addrs;
+			}
+			if(hosts[i].req.ar_result)
+				freeaddrinfo(hosts[i].req.ar_result);
+		}
+	}
+	free(list);
+}
+
+static void *refresh_main(void *arg)
+{
+	resolve_hosts();
+	atomic_store(&refresh_done, 1);
+	return NULL;
+}
+
+static int start_refresh()
+{
+	sigset_t block, old;
+	int err;
+
+	/* Signals are handled by the main thread. */
+	sigemptyset(&block);
+	sigaddset(&block, SIGINT);
+	sigaddset(&block, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &block, &old);
+	atomic_store(&refresh_done, 0);
+	err = pthread_create(&refresh_thread, NULL, refresh_main, NULL);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if(err) {
+		fprintf(stderr, "pthread_create(): %s\n", strerror(err));
+		return -1;
+	}
+	refreshing = 1;
+	return 0;
+}
+
+/* Make a new list of the current answers, and record how long the lookups
+ * took. */
+static int install()
+{
+	struct resolve_list *list;
+	struct curl_slist *entries;
+	char *buf;
+	int i;
+
+	if(!(list = calloc(1, sizeof(*list)))) {
+		perror("calloc");
+		return -1;
+	}
+	list->refs = 1;
+	list->generation = ++generation;
+	for(i = 0; i < nhosts; i++) {
+		if(resolve_hist)
+			hist_record(resolve_hist, hosts[i].time_ns / 1000);
+	}
+	for(i = 0; i < nnames; i++) {
+		if(!hosts[names[i].h].addrs)
+			continue;
+		if(asprintf(&buf, "%s:%ld:%s", names[i].host, names[i].port, hosts[names[i].h].addrs) < 0 ||
+		   !(entries = curl_slist_append(list->entries, buf))) {
+			perror("Unable to add resolve entry");
+			resolve_put(list);
+			return -1;
+		}
+		free(buf);
+		list->entries = entries;
+	}
+	resolve_put(current);
+	current = list;
+	return 0;
+}
+
+/* Resolve every name up front. Names that fail are left for cURL to resolve
+ * when they are used. */
+int resolve_init(struct options *opt, struct histogram *hist)
+{
+	int i;
+
+	resolve_hist = hist;
+	ai_family = opt->ai_family;
+	refresh_ns = (long long)opt->resolve_refresh * 1000000000;
+	atomic_init(&refresh_done, 0);
+	if(collect_names(opt))
+		return -1;
+	resolve_hosts();
+	for(i = 0; i < nhosts; i++) {
+		if(hosts[i].err)
+			fprintf(stderr, "Unable to resolve %s: %s\n", hosts[i].name, gai_strerror(hosts[i].err));
+	}
+	clock_gettime(CLOCK_MONOTONIC, &next_refresh);
+	ts_add_ns(&next_refresh, refresh_ns);
+	return install();
+}
+
+void resolve_destroy()
+{
+	int i;
+	if(refreshing)
+		pthread_join(refresh_thread, NULL);
+	refreshing = 0;
+	resolve_put(current);
+	current = NULL;
+	for(i = 0; i < nhosts; i++)
+		free(hosts[i].addrs);
+	for(i = 0; i < nnames; i++)
+		free(names[i].host);
+	for(i = 0; i < npending; i++)
+		free(pending[i].host);
+	free(hosts);
+	free(names);
+	free(pending);
+	table_ref_clear(&ref);
+	hosts = NULL;
+	names = NULL;
+	pending = NULL;
+	nhosts = nnames = npending = 0;
+}
+
+/* Pick up the names of a fetched list as it arrives; the ones not seen before
+ * wait for resolve_update() to look them up. */
+void resolve_cycle(const struct cycle *c)
+{
+	struct resolve_name *n;
+	int count;
+	CURLU *u;
+	size_t i;
+
+	if(!current || !table_ref_newer(&ref, c->urls, c->id))
+		return;
+	table_ref_set(&ref, c->urls, c->list, c->id);
+	if(!(u = curl_url())) {
+		fprintf(stderr, "Unable to allocate cURL URL handle.\n");
+		return;
+	}
+	for(i = 0; i < c->urls->count; i++) {
+		count = npending;
+		if(add_name(u, url_get(c->urls, i), &pending, &npending))
+			break;
+		if(npending == count)
+			continue;
+		n = &pending[count];
+		if(bsearch(n, names, nnames, sizeof(*names), name_cmp)) {
+			free(n->host);
+			npending = count;
+		}
+	}
+	curl_url_cleanup(u);
+}
+
+/* The current list, with a reference for the caller; NULL if nothing has been
+ * resolved up front. */
+struct resolve_list *resolve_get()
+{
+	if(current)
+		current->refs++;
+	return current;
+}
+
+void resolve_put(struct resolve_list *list)
+{
+	if(!list || --list->refs)
+		return;
+	curl_slist_free_all(list->entries);
+	free(list);
+}
+
+/* Called from the main loop: start a refresh when one is due or there are new
+ * names to look up, and install its result once it is done. Returns 1 if a new
+ * list was installed. */
+int resolve_update()
+{
+	struct timespec now;
+
+	if(!current)
+		return 0;
+	if(refreshing) {
+		if(!atomic_load(&refresh_done))
+			return 0;
+		pthread_join(refresh_thread, NULL);
+		refreshing = 0;
+		clock_gettime(CLOCK_MONOTONIC, &next_refresh);
+		ts_add_ns(&next_refresh, refresh_ns);
+		return install() ? 0 : 1;
+	}
+	if(npending) {
+		if(!merge_pending())
+			start_refresh();
+		return 0;
+	}
+	if(!refresh_ns)
+		return 0;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if(ts_diff_ns(&now, &next_refresh) >= 0 && start_refresh()) {
+		next_refresh = now;
+		ts_add_ns(&next_refresh, refresh_ns);
+	}
+	return 0;
+}
@@ -0,0 +1,52 @@
+/**
+ * ring.c
+ *
+ * Toke Høiland-Jørgensen
+ * 2026-10-17
+ */
+
+#include <stdio.h>
+#include <sys/mman.h>
+#include "ring.h"
+
+/* Must be created before forking, so both sides map the same memory. */
+struct result_ring *ring_create()
+{
+	struct result_ring *ring;
+	ring = mmap(NULL, sizeof(*ring), PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+	if(ring == MAP_FAILED) {
+		perror("mmap()");
+		return NULL;
+	}
+	atomic_init(&ring->head, 0);
+	atomic_init(&ring->tail, 0);
+	atomic_init(&ring->cancel, 0);
+	return ring;
+}
+
+void ring_destroy(struct result_ring *ring)
+{
+	if(ring) munmap(ring, sizeof(*ring));
+}
+
+/* Returns -1 if the ring is full. */
+int ring_push(struct result_ring *ring, const struct result *r)
+{
+	uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	if(head - atomic_load_explicit(&ring->tail, memory_order_acquire) == RING_SIZE)
+		return -1;
+	ring->slots[head % RING_SIZE] = *r;
+	atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+	return 0;
+}
+
+/* Returns 0 if the ring is empty, 1 if a result was popped into r. */
+int ring_pop(struct result_ring *ring, struct result *r)
+{
+	uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+	if(tail == atomic_load_explicit(&ring->head, memory_order_acquire))
+		return 0;
+	*r = ring->slots[tail % RING_SIZE];
+	atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+	return 1;
+}
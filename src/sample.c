@@ -0,0 +1,179 @@
+/**
+ * sample.c
+ *
+ * Toke Høiland-Jørgensen
+ * 2026-10-17
+ *
+ * URL sampling with the alias method (in Vose's variant): the table is built
+ * in linear time once per URL list, after which a draw is one random number,
+ * a table lookup and a comparison, however long the list is. Cycles still
+ * running on an older fetched list than the one the aliases were built for
+ * draw uniformly from it.
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "sample.h"
+#include "util.h"
+
+struct alias_entry {
+	double prob;
+	uint32_t alias;
+};
+
+static int mode = SAMPLE_NONE;
+static double zipf_s = 1.0;
+static int count = 0;
+static struct table_ref ref = TABLE_REF_INIT;
+static struct alias_entry *aliases = NULL;
+static unsigned short xsubi[3];
+
+/* The weight is the field of a line that is a plain number (the others are
+ * name=value). A line without one weighs 1; -1 if the weight is invalid. */
+static double line_weight(struct url_table *t, size_t i)
+{
+	char *p = url_table_fields(t, i), *end;
+	size_t len;
+	double w;
+
+	while(p && *p) {
+		len = strcspn(p, " \t");
+		if(!memchr(p, '=', len)) {
+			w = strtod(p, &end);
+			return end == p + len && w >= 0 && !isinf(w) ? w : -1;
+		}
+		p += len;
+		p += strspn(p, " \t");
+	}
+	return 1;
+}
+
+/* Vose's alias method: the weights are scaled to average 1, and every entry
+ * below 1 is topped up from one above it, which becomes its alias. The small
+ * and the large entries are kept on stacks at either end of one array. */
+static struct alias_entry *build_aliases(struct url_table *t)
+{
+	struct alias_entry *a;
+	uint32_t *work = NULL;
+	size_t i, n = t->count, ns = 0, nl = 0, s, l;
+	double w, sum = 0;
+
+	if(n > UINT32_MAX) {
+		fprintf(stderr, "Too many URLs to sample from.\n");
+		return NULL;
+	}
+	if(!(a = malloc(n * sizeof(*a))) || !(work = malloc(n * sizeof(*work)))) {
+		perror("malloc");
+		goto err;
+	}
+	for(i = 0; i < n; i++) {
+		w = mode == SAMPLE_ZIPF ? pow(i + 1, -zipf_s) : line_weight(t, i);
+		if(w < 0) {
+			fprintf(stderr, "Invalid URL weight: %s\n", url_get(t, i));
+			goto err;
+		}
+		a[i].prob = w;
+		sum += w;
+	}
+	if(!(sum > 0)) {
+		fprintf(stderr, "The URL weights add up to nothing.\n");
+		goto err;
+	}
+	for(i = 0; i < n; i++) {
+		a[i].prob *= n / sum;
+		a[i].alias = i;
+		if(a[i].prob < 1)
+			work[ns++] = i;
+		else
+			work[n - ++nl] = i;
+	}
+	while(ns && nl) {
+		s = work[--ns];
+		l = work[n - nl];
+		a[s].alias = l;
+		a[l].prob -= 1 - a[s].prob;
+		if(a[l].prob < 1) {
+			nl--;
+			work[ns++] = l;
+		}
+	}
+	/* What is left is 1 but for rounding. */
+	while(ns)
+		a[work[--ns]].prob = 1;
+	while(nl)
+		a[work[n - nl--]].prob = 1;
+	free(work);
+	return a;
+
+err:
+	free(a);
+	free(work);
+	return NULL;
+}
+
+static void set_table(struct url_table *t, struct url_list *l, int cycle)
+{
+	free(aliases);
+	aliases = NULL;
+	if(mode != SAMPLE_UNIFORM && t->count && !(aliases = build_aliases(t)))
+		fprintf(stderr, "Sampling URLs uniformly instead.\n");
+	table_ref_set(&ref, t, l, cycle);
+}
+
+static int draw(size_t n, const struct alias_entry *a)
+{
+	double u = erand48(xsubi) * n;
+	size_t i = min((size_t)u, n - 1);
+	return a && u - i >= a[i].prob ? (int)a[i].alias : (int)i;
+}
+
+/* Count is the number of URLs per cycle, or 0 for as many as the list has.
+ * The table of a URL file is set up straight away, so that the weights are off
+ * its lines before anything else looks at them. */
+int sample_init(int sample_mode, double s, int n, struct url_table *urls)
+{
+	struct timespec now;
+
+	mode = sample_mode;
+	zipf_s = s;
+	count = n;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	xsubi[0] = now.tv_nsec;
+	xsubi[1] = now.tv_nsec >> 16;
+	xsubi[2] = getpid();
+	if(mode == SAMPLE_NONE || !urls->count)
+		return 0;
+	set_table(urls, NULL, 0);
+	return mode != SAMPLE_UNIFORM && !aliases ? -1 : 0;
+}
+
+/* Draw the URLs of a cycle, once its URL table is known. The URLs of a replay
+ * are given, and are left alone. */
+void sample_cycle(struct cycle *c)
+{
+	size_t i, n, draws;
+
+	if(mode == SAMPLE_NONE || c->indexes || !c->urls || !(n = c->urls->count))
+		return;
+	if(table_ref_newer(&ref, c->urls, c->id))
+		set_table(c->urls, c->list, c->id);
+	draws = count ? count : n;
+	if(!(c->indexes = malloc(draws * sizeof(*c->indexes)))) {
+		perror("malloc");
+		return;
+	}
+	for(i = 0; i < draws; i++)
+		c->indexes[i] = draw(n, c->urls == ref.table ? aliases : NULL);
+	c->nindexes = draws;
+}
+
+void sample_destroy()
+{
+	free(aliases);
+	table_ref_clear(&ref);
+	aliases = NULL;
+	mode = SAMPLE_NONE;
+}
@@ -0,0 +1,77 @@
+/**
+ * scheduler.c
+ *
+ * Toke Høiland-Jørgensen
+ * 2026-10-17
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "scheduler.h"
+#include "util.h"
+
+void sched_init(struct scheduler *s, int mode, int interval_ms)
+{
+	s->mode = mode;
+	s->interval_ns = (long long)interval_ms * 1000000;
+	clock_gettime(CLOCK_MONOTONIC, &s->next);
+	s->xsubi[0] = s->next.tv_nsec;
+	s->xsubi[1] = s->next.tv_nsec >> 16;
+	s->xsubi[2] = getpid();
+}
+
+/* Return the intended start time of the next cycle, and (for the open-loop
+ * modes) advance the schedule past it. */
+void sched_next(struct scheduler *s, struct timespec *intended)
+{
+	*intended = s->next;
+	switch(s->mode) {
+	case SCHED_FIXED:
+		ts_add_ns(&s->next, s->interval_ns);
+		break;
+	case SCHED_POISSON:
+		ts_add_ns(&s->next, -log(1.0 - erand48(s->xsubi)) * s->interval_ns);
+		break;
+	}
+}
+
+/* Takes effect from the cycle after the next one in the open-loop modes, whose
+ * next start time has already been drawn. */
+void sched_set_interval(struct scheduler *s, long long interval_ns)
+{
+	s->interval_ns = interval_ns;
+}
+
+/* In closed-loop mode the schedule follows the actual start time, like the
+ * original busy-wait loop did. */
+void sched_started(struct scheduler *s, const struct timespec *start)
+{
+	if(s->mode != SCHED_CLOSED)
+		return;
+	s->next = *start;
+	ts_add_ns(&s->next, s->interval_ns);
+}
+
+/* Returns early if a signal interrupts the sleep, so that the caller can
+ * stop. */
+void sched_sleep(const struct timespec *until)
+{
+	clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, until, NULL);
+}
+
+/* Whole milliseconds from now until *until, for use as a poll timeout; -1 if
+ * there is no deadline. Rounding down means pollers return slightly early,
+ * and the remainder can be slept off precisely with sched_sleep(). */
+int sched_timeout_ms(const struct timespec *until)
+{
+	struct timespec now;
+	long long ns;
+	if(!until)
+		return -1;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ns = ts_diff_ns(until, &now);
+	if(ns <= 0)
+		return 0;
+	return ns / 1000000;
+}
@@ -0,0 +1,199 @@
+/**
+ * stats.c
+ *
+ * Toke Høiland-Jørgensen
+ * 2026-10-17
+ */
+
+#include <string.h>
+#include "stats.h"
+#include "util.h"
+
+void result_phases(const struct result *r, curl_off_t *phases)
+{
+	const curl_off_t *t = r->times;
+	curl_off_t handshake = max(t[TIME_APPCONNECT], t[TIME_CONNECT]);
+
+	/* cURL reports zero for phases that did not happen (e.g. on a reused
+	 * connection), so clamp everything to be monotonic before subtracting. */
+	phases[PHASE_DNS] = t[TIME_NAMELOOKUP];
+	phases[PHASE_CONNECT] = t[TIME_CONNECT] ? max(t[TIME_CONNECT] - t[TIME_NAMELOOKUP], 0) : 0;
+	phases[PHASE_TLS] = t[TIME_APPCONNECT] ? max(t[TIME_APPCONNECT] - t[TIME_CONNECT], 0) : 0;
+	phases[PHASE_SERVER] = max(t[TIME_STARTTRANSFER] - max(handshake, t[TIME_NAMELOOKUP]), 0);
+	phases[PHASE_TRANSFER] = max(t[TIME_TOTAL] - max(t[TIME_STARTTRANSFER], handshake), 0);
+}
+
+void hist_reset(struct histogram *h)
+{
+	memset(h, 0, sizeof(*h));
+}
+
+/* The bucket layout for a given number of sub-bucket bits; sub_bits is always
+ * a constant, so these fold down to the same code as a fixed layout. */
+static inline int bucket_index(uint64_t value, int sub_bits)
+{
+	int sub_buckets = 1 << sub_bits, msb, shift;
+	if(value < sub_buckets)
+		return value;
+	msb = 63 - __builtin_clzll(value);
+	if(msb >= HIST_MAX_BITS)
+		return HIST_NBUCKETS(sub_bits) - 1;
+	shift = msb - sub_bits + 1;
+	return sub_buckets + (shift - 1) * (sub_buckets / 2) +
+		(value >> shift) - sub_buckets / 2;
+}
+
+/* Highest value that maps to the same bucket as idx. */
+static inline uint64_t bucket_value(int idx, int sub_bits)
+{
+	int sub_buckets = 1 << sub_bits, shift;
+	uint64_t sub;
+	if(idx < sub_buckets)
+		return idx;
+	shift = (idx - sub_buckets) / (sub_buckets / 2) + 1;
+	sub = (idx - sub_buckets) % (sub_buckets / 2) + sub_buckets / 2;
+	return ((sub + 1) << shift) - 1;
+}
+
+/* The value at a percentile of count samples in the buckets of the given
+ * layout, whose counts are width bytes each (32 or 64 bits). */
+static inline uint64_t bucket_percentile(const void *counts, size_t width, int sub_bits,
+					 uint64_t count, uint64_t max_value, double percentile)
+{
+	uint64_t target, seen = 0;
+	int i;
+	if(!count)
+		return 0;
+	target = (uint64_t)(percentile / 100 * count + 0.5);
+	if(target < 1) target = 1;
+	for(i = 0; i < HIST_NBUCKETS(sub_bits); i++) {
+		seen += width == sizeof(uint64_t) ? ((const uint64_t *)counts)[i] : ((const uint32_t *)counts)[i];
+		if(seen >= target)
+			return min(bucket_value(i, sub_bits), max_value);
+	}
+	return max_value;
+}
+
+static int hist_index(uint64_t value)
+{
+	return bucket_index(value, HIST_SUB_BITS);
+}
+
+void hist_record(struct histogram *h, uint64_t value)
+{
+	h->counts[hist_index(value)]++;
+	h->count++;
+	if(value > h->max) h->max = value;
+}
+
+void hist_merge(struct histogram *dst, const struct histogram *src)
+{
+	int i;
+	if(!src->count)
+		return;
+	for(i = 0; i < HIST_BUCKETS; i++)
+		dst->counts[i] += src->counts[i];
+	dst->count += src->count;
+	if(src->max > dst->max) dst->max = src->max;
+}
+
+uint64_t hist_percentile(const struct histogram *h, double percentile)
+{
+	return bucket_percentile(h->counts, sizeof(h->counts[0]), HIST_SUB_BITS,
+				 h->count, h->max, percentile);
+}
+
+int chist_index(uint64_t value)
+{
+	return bucket_index(value, CHIST_SUB_BITS);
+}
+
+void chist_record(struct compact_histogram *h, uint64_t value)
+{
+	h->counts[bucket_index(value, CHIST_SUB_BITS)]++;
+	h->count++;
+	if(value > h->max) h->max = value;
+}
+
+uint64_t chist_percentile(const struct compact_histogram *h, double percentile)
+{
+	return bucket_percentile(h->counts, sizeof(h->counts[0]), CHIST_SUB_BITS,
+				 h->count, h->max, percentile);
+}
+
+void hist_print(FILE *output, const char *name, const struct histogram *h)
+{
+	fprintf(output, "%s p50/p90/p99/p99.9/max = %.3f/%.3f/%.3f/%.3f/%.3f ms (%lu samples).\n", name,
+		(double)hist_percentile(h, 50) / 1000,
+		(double)hist_percentile(h, 90) / 1000,
+		(double)hist_percentile(h, 99) / 1000,
+		(double)hist_percentile(h, 99.9) / 1000,
+		(double)h->max / 1000,
+		(unsigned long)h->count);
+}
+
+void cycle_stats_reset(struct cycle_stats *cs, struct histogram *request_hist)
+{
+	memset(cs, 0, sizeof(*cs));
+	cs->request_hist = request_hist;
+}
+
+void cycle_stats_add(struct cycle_stats *cs, const struct result *r)
+{
+	curl_off_t phases[NUM_PHASES];
+	int i;
+
+	if(r->hedge)
+		cs->hedged++;
+	if(r->hedge == HEDGE_WON)
+		cs->hedge_wins++;
+	if(r->status) {
+		cs->errors++;
+		return;
+	}
+	cs->requests++;
+	cs->bytes += r->bytes;
+	cs->connects += r->connects;
+	if(cs->request_hist) hist_record(cs->request_hist, r->times[TIME_TOTAL]);
+	result_phases(r, phases);
+	for(i = 0; i < NUM_PHASES; i++) {
+		cs->phase_sum[i] += phases[i];
+		if(phases[i] > cs->phase_max[i]) cs->phase_max[i] = phases[i];
+	}
+}
+
+/* Fold the statistics collected in src into dst, including src's request time
+ * histogram into dst's. */
+void cycle_stats_merge(struct cycle_stats *dst, const struct cycle_stats *src)
+{
+	int i;
+	dst->requests += src->requests;
+	dst->errors += src->errors;
+	dst->missed += src->missed;
+	dst->hedged += src->hedged;
+	dst->hedge_wins += src->hedge_wins;
+	dst->bytes += src->bytes;
+	dst->connects += src->connects;
+	for(i = 0; i < NUM_PHASES; i++) {
+		dst->phase_sum[i] += src->phase_sum[i];
+		if(src->phase_max[i] > dst->phase_max[i]) dst->phase_max[i] = src->phase_max[i];
+	}
+	if(dst->request_hist && src->request_hist)
+		hist_merge(dst->request_hist, src->request_hist);
+}
+
+void print_cycle_timings(FILE *output, const struct cycle_stats *cs)
+{
+	int n = max(cs->requests, 1);
+	fprintf(output, " dns/connect/tls/server/transfer avg = %.3f/%.3f/%.3f/%.3f/%.3f ms, max = %.3f/%.3f/%.3f/%.3f/%.3f ms.",
+		(double)cs->phase_sum[PHASE_DNS] / n / 1000,
+		(double)cs->phase_sum[PHASE_CONNECT] / n / 1000,
+		(double)cs->phase_sum[PHASE_TLS] / n / 1000,
+		(double)cs->phase_sum[PHASE_SERVER] / n / 1000,
+		(double)cs->phase_sum[PHASE_TRANSFER] / n / 1000,
+		(double)cs->phase_max[PHASE_DNS] / 1000,
+		(double)cs->phase_max[PHASE_CONNECT] / 1000,
+		(double)cs->phase_max[PHASE_TLS] / 1000,
+		(double)cs->phase_max[PHASE_SERVER] / 1000,
+		(double)cs->phase_max[PHASE_TRANSFER] / 1000);
+}
@@ -0,0 +1,529 @@
+/**
+ * threads.c
+ *
+ * Toke Høiland-Jørgensen
+ * 2026-10-17
+ *
+ * Threaded engine: one thread per worker, each with its own cURL handle. The
+ * URLs of a cycle are published as one batch, split into a range per thread.
+ * Threads claim URLs from their own range with an atomic increment, and steal
+ * from the other ranges once theirs has run dry. Results go into per-thread
+ * slots of the batch and are merged into the cycle when the batch is done, so
+ * the range counters are all the threads share on the per-request path.
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <curl/curl.h>
+#include "engine.h"
+#include "resolve.h"
+#include "output.h"
+#include "scheduler.h"
+#include "transfer.h"
+#include "util.h"
+
+#define CACHELINE 64
+
+struct batch_range {
+	atomic_int next;
+	int end;
+} __attribute__((aligned(CACHELINE)));
+
+struct batch_slot {
+	struct cycle_stats stats;
+	struct histogram hist;
+	int err;
+} __attribute__((aligned(CACHELINE)));
+
+/* A batch is either the URL list fetch of a cycle (first == -1, count == 1) or
+ * all of its remaining URLs. The cycle itself is only ever touched by the main
+ * thread; users, exhausted and finished are protected by the lock. */
+struct batch {
+	struct batch *next;
+	struct cycle *cycle;
+	int cycle_id;
+	struct url_table *urls;
+	const int *indexes;
+	const char *urls_loc;
+	struct timespec deadline;
+	int first;
+	int count;
+	int users;
+	int exhausted;
+	int finished;
+	struct curl_slist *headers;
+	struct resolve_list *resolve;
+	struct url_list *list;
+	int list_ok;
+	long code;
+	char *etag;
+	char *last_modified;
+	struct result *results;
+	struct batch_range *ranges;
+	struct batch_slot *slots;
+};
+
+struct thread {
+	pthread_t tid;
+	int id;
+	int started;
+	int dead;
+	int cycle_id;
+	unsigned int resolve_gen;
+	CURL *curl;
+	struct transfer_data td;
+};
+
+static struct options *opt;
+static struct thread *threads = NULL;
+static int nthreads = 0;
+static int concurrency = 0;
+static int keep_results = 0;
+static pthread_mutex_t lock;
+static pthread_cond_t work = PTHREAD_COND_INITIALIZER;
+static struct batch *batches = NULL;
+static int pending = 0;
+static atomic_int stopping;
+static int efd = -1;
+
+static int thread_stopping(void *ctx)
+{
+	return atomic_load_explicit(&stopping, memory_order_relaxed);
+}
+
+static int init_handle(struct thread *t)
+{
+	t->td.urls = NULL;
+	t->td.cancelled = thread_stopping;
+	t->resolve_gen = 0;
+	t->curl = curl_easy_init();
+	if(!t->curl ||
+	   setup_handle(t->curl, opt, &t->td) != CURLE_OK ||
+	   curl_easy_setopt(t->curl, CURLOPT_NOSIGNAL, 1L) != CURLE_OK) {
+		fprintf(stderr, "Unable to initialise cURL handle.\n");
+		curl_easy_cleanup(t->curl);
+		t->curl = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+static void free_batch(struct batch *b)
+{
+	url_list_put(b->list);
+	curl_slist_free_all(b->headers);
+	resolve_put(b->resolve);
+	free(b->etag);
+	free(b->last_modified);
+	free(b->results);
+	free(b->ranges);
+	free(b->slots);
+	free(b);
+}
+
+static void get_url(struct thread *t, struct batch *b, struct batch_slot *slot, int idx)
+{
+	const char *url, *etag, *last_modified;
+	struct result r;
+	CURLcode res;
+	int missed;
+
+	result_init(&r);
+	r.url = b->indexes ? b->indexes[b->first + idx] : b->first + idx;
+	r.worker = t->id;
+	clock_gettime(CLOCK_MONOTONIC, &r.started);
+	url = r.url == -1 ? b->urls_loc : url_get(b->urls, r.url);
+
+	/* URLs still left in the batch when the deadline passes are missed
+	 * without being tried. */
+	if(deadline_passed(&b->deadline)) {
+		res = CURLE_OPERATION_TIMEDOUT;
+		goto out;
+	}
+	if(t->dead) {
+		res = CURLE_FAILED_INIT;
+		goto out;
+	}
+	if(opt->debug) {
+		fprintf(stderr, "Getting URL '%s'.\n", url);
+	}
+	if(r.url == -1) {
+		t->td.urls = &b->list->urls;
+		curl_easy_setopt(t->curl, CURLOPT_HTTPHEADER, b->headers);
+	}
+	/* The batch holds a reference to the names resolved up front, so
+	 * they stay around for as long as a handle may be using them. */
+	if(b->resolve && t->resolve_gen != b->resolve->generation) {
+		curl_easy_setopt(t->curl, CURLOPT_RESOLVE, b->resolve->entries);
+		t->resolve_gen = b->resolve->generation;
+	}
+	curl_easy_setopt(t->curl, CURLOPT_URL, url);
+	set_transfer_timeout(t->curl, opt, deadline_left_ms(&b->deadline));
+	transfer_start(&t->td);
+	res = curl_easy_perform(t->curl);
+out:
+	r.status = res;
+	missed = deadline_missed(&b->deadline, res);
+	if(res == CURLE_OK) {
+		get_result(t->curl, &r);
+		res = transfer_result(&t->td, &r);
+	} else if(atomic_load(&stopping) || missed) {
+		/* Aborted by destroy(), or cut short by the deadline. */
+	} else if(r.url == -1) {
+		fprintf(stderr, "cURL error: '%s' while getting URL list at %s.\n", curl_easy_strerror(res), url);
+	} else {
+		fprintf(stderr, "cURL error: %s for URL '%s'.\n", curl_easy_strerror(res), url);
+	}
+
+	/* The validators only live as long as the handle is not reused, so
+	 * take copies for the main thread. The list fetch result is accounted
+	 * by the cycle itself. */
+	if(r.url == -1) {
+		t->td.urls = NULL;
+		curl_easy_setopt(t->curl, CURLOPT_HTTPHEADER, NULL);
+		if(res == CURLE_OK && url_table_finish(&b->list->urls) == 0) {
+			b->code = get_list_validators(t->curl, &etag, &last_modified);
+			b->etag = etag ? strdup(etag) : NULL;
+			b->last_modified = last_modified ? strdup(last_modified) : NULL;
+			b->list_ok = 1;
+		}
+	} else if(missed) {
+		slot->stats.missed++;
+	} else {
+		cycle_stats_add(&slot->stats, &r);
+		if(r.status)
+			slot->err = r.status;
+	}
+	if(b->results)
+		b->results[idx] = r;
+}
+
+/* Work through our own range of the batch, then steal from the others.
+ * Returns -1 if the thread could not get a handle to work with. */
+static int run_batch(struct thread *t, struct batch *b)
+{
+	struct batch_slot *slot = &b->slots[t->id];
+	struct batch_range *range;
+	int i, idx;
+
+	/* Start each cycle on a new handle unless in keep-alive mode. If that
+	 * fails, leave the URLs to the other threads. A thread that is dead
+	 * only takes a batch once there is no other thread left to, and fails
+	 * the URLs that are left in it. */
+	if(!t->dead && (!t->curl || (!opt->keepalive && t->cycle_id != b->cycle_id))) {
+		curl_easy_cleanup(t->curl);
+		if(init_handle(t))
+			return -1;
+	}
+	t->cycle_id = b->cycle_id;
+
+	for(i = 0; i < nthreads; i++) {
+		range = &b->ranges[(t->id + i) % nthreads];
+		while(!atomic_load_explicit(&stopping, memory_order_relaxed) &&
+		      (idx = atomic_fetch_add_explicit(&range->next, 1, memory_order_relaxed)) < range->end)
+			get_url(t, b, slot, idx);
+	}
+	return 0;
+}
+
+/* The threads that are allowed to work and have a handle to work with. Called
+ * with the lock held. */
+static int live_threads()
+{
+	int i, n = 0;
+	for(i = 0; i < concurrency; i++)
+		n += !threads[i].dead;
+	return n;
+}
+
+static struct batch *find_batch()
+{
+	struct batch *b;
+	for(b = batches; b; b = b->next) {
+		if(!b->exhausted)
+			return b;
+	}
+	return NULL;
+}
+
+/* A batch is done once every URL has been claimed and every thread that was
+ * working on it has left it. */
+static void *thread_main(void *arg)
+{
+	struct thread *t = arg;
+	struct batch *b = NULL;
+	uint64_t one = 1;
+	int failed;
+
+	while(1) {
+		pthread_mutex_lock(&lock);
+		while(!atomic_load(&stopping) && (t->id >= concurrency || !(b = find_batch()) ||
+						 (t->dead && live_threads())))
+			pthread_cond_wait(&work, &lock);
+		if(atomic_load(&stopping)) {
+			pthread_mutex_unlock(&lock);
+			break;
+		}
+		b->users++;
+		pthread_mutex_unlock(&lock);
+
+		failed = run_batch(t, b);
+
+		pthread_mutex_lock(&lock);
+		if(failed) {
+			t->dead = 1;
+			pthread_cond_broadcast(&work);
+		} else {
+			b->exhausted = 1;
+		}
+		if(--b->users == 0 && b->exhausted && !b->finished) {
+			b->finished = 1;
+			if(write(efd, &one, sizeof(one)) < 0)
+				perror("write()");
+		}
+		pthread_mutex_unlock(&lock);
+	}
+	return NULL;
+}
+
+/* The URLs are split between the threads that are currently allowed to work;
+ * the others get empty ranges. */
+static int publish_batch(struct cycle *c, int first, int count)
+{
+	struct batch *b, **p;
+	int i, n = concurrency;
+
+	if(!(b = calloc(1, sizeof(*b))))
+		goto err;
+	b->cycle = c;
+	b->cycle_id = c->id;
+	b->urls = c->urls;
+	b->indexes = c->indexes;
+	b->urls_loc = c->urls_loc;
+	b->deadline = c->deadline;
+	b->resolve = resolve_get();
+	b->first = first;
+	b->count = count;
+	if(posix_memalign((void **)&b->ranges, CACHELINE, nthreads * sizeof(*b->ranges)) ||
+	   posix_memalign((void **)&b->slots, CACHELINE, nthreads * sizeof(*b->slots)))
+		goto err;
+	memset(b->slots, 0, nthreads * sizeof(*b->slots));
+	for(i = 0; i < nthreads; i++) {
+		atomic_init(&b->ranges[i].next, (long long)count * min(i, n) / n);
+		b->ranges[i].end = (long long)count * min(i + 1, n) / n;
+		cycle_stats_reset(&b->slots[i].stats, &b->slots[i].hist);
+	}
+	if(first == -1) {
+		if(!(b->list = url_list_new()))
+			goto err;
+		b->headers = list_request_headers(list_cache_etag(), list_cache_last_modified());
+	}
+	if((first == -1 || keep_results) &&
+	   !(b->results = calloc(count, sizeof(*b->results))))
+		goto err;
+
+	pthread_mutex_lock(&lock);
+	for(p = &batches; *p; p = &(*p)->next);
+	*p = b;
+	pthread_cond_broadcast(&work);
+	pthread_mutex_unlock(&lock);
+	pending++;
+	return 0;
+
+err:
+	perror("Unable to allocate batch");
+	if(b) free_batch(b);
+	return -1;
+}
+
+static void finish_batch(struct batch *b)
+{
+	struct cycle *c = b->cycle;
+	struct url_list *list;
+	int i, err = 0;
+
+	if(b->first == -1) {
+		if(b->list_ok) {
+			list = list_cache_update(b->code, b->list, b->etag, b->last_modified);
+			b->list = NULL;
+			cycle_set_list(c, list, b->code == 304 ? LIST_NOT_MODIFIED : LIST_FETCHED);
+		}
+		cycle_add_result(c, &b->results[0]);
+		return;
+	}
+
+	for(i = 0; i < nthreads; i++) {
+		if(b->slots[i].err)
+			err = b->slots[i].err;
+		if(i)
+			cycle_stats_merge(&b->slots[0].stats, &b->slots[i].stats);
+	}
+	cycle_add_batch(c, &b->slots[0].stats, err, b->results, b->count);
+}
+
+/* Hand finished batches back to their cycles. */
+static void collect()
+{
+	struct batch *done = NULL, **tail = &done, **p, *b;
+
+	pthread_mutex_lock(&lock);
+	for(p = &batches; *p;) {
+		b = *p;
+		if(b->finished) {
+			*p = b->next;
+			b->next = NULL;
+			*tail = b;
+			tail = &b->next;
+		} else {
+			p = &b->next;
+		}
+	}
+	pthread_mutex_unlock(&lock);
+
+	while((b = done)) {
+		done = b->next;
+		finish_batch(b);
+		free_batch(b);
+		pending--;
+	}
+}
+
+static int thread_poll(const struct timespec *until)
+{
+	struct pollfd pfd = {.fd = efd, .events = POLLIN};
+	struct cycle *c;
+	int first, count, ms;
+	uint64_t val;
+
+	do {
+		collect();
+		while(cycle_take_batch(&c, &first, &count)) {
+			if(publish_batch(c, first, count))
+				return -1;
+		}
+		if(!pending) return 0;
+
+		ms = sched_timeout_ms(until);
+		if(ms == 0) return 0;
+		if(poll(&pfd, 1, ms) < 0) {
+			if(errno == EINTR) return 0;
+			perror("poll()");
+			return -1;
+		}
+		if(pfd.revents & POLLIN && read(efd, &val, sizeof(val)) < 0)
+			perror("read()");
+	} while(1);
+}
+
+static int thread_start_cycle(struct cycle *c)
+{
+	cycle_start(c);
+	return 0;
+}
+
+static int thread_init(struct options *o)
+{
+	sigset_t block, old;
+	int i;
+
+	opt = o;
+	nthreads = concurrency = opt->workers;
+	/* Individual results are only needed by the consumers of the request
+	 * callback. */
+	keep_results = opt->format != FORMAT_TEXT || opt->url_stats || opt->profile ||
+		opt->stats_socket || opt->trace_out || opt->verify || opt->encodings ||
+		opt->throughput_interval;
+	if(curl_global_init(CURL_GLOBAL_DEFAULT) != CURLE_OK) {
+		fprintf(stderr, "Unable to initialise cURL.\n");
+		return -1;
+	}
+	if((efd = eventfd(0, EFD_CLOEXEC)) < 0) {
+		perror("eventfd()");
+		return -1;
+	}
+	pthread_mutex_init(&lock, NULL);
+	atomic_init(&stopping, 0);
+
+	threads = calloc(nthreads, sizeof(*threads));
+	if(!threads) {
+		perror("calloc");
+		return -1;
+	}
+	for(i = 0; i < nthreads; i++) {
+		threads[i].id = i;
+		threads[i].cycle_id = -1;
+		if(init_handle(&threads[i]))
+			return -1;
+	}
+
+	/* Signals are handled by the main thread. */
+	sigemptyset(&block);
+	sigaddset(&block, SIGINT);
+	sigaddset(&block, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &block, &old);
+	for(i = 0; i < nthreads; i++) {
+		if(pthread_create(&threads[i].tid, NULL, thread_main, &threads[i])) {
+			perror("pthread_create()");
+			break;
+		}
+		threads[i].started = 1;
+	}
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	return i < nthreads ? -1 : 0;
+}
+
+/* Threads above the limit stay asleep once they are done with the batch they
+ * are working on. */
+static void thread_set_concurrency(int n)
+{
+	pthread_mutex_lock(&lock);
+	concurrency = n;
+	pthread_cond_broadcast(&work);
+	pthread_mutex_unlock(&lock);
+}
+
+static void thread_destroy()
+{
+	struct batch *b;
+	int i;
+
+	if(!threads) return;
+	atomic_store(&stopping, 1);
+	pthread_mutex_lock(&lock);
+	pthread_cond_broadcast(&work);
+	pthread_mutex_unlock(&lock);
+
+	for(i = 0; i < nthreads; i++) {
+		if(threads[i].started)
+			pthread_join(threads[i].tid, NULL);
+		if(threads[i].curl)
+			curl_easy_cleanup(threads[i].curl);
+		transfer_data_destroy(&threads[i].td);
+	}
+	free(threads);
+	threads = NULL;
+	while((b = batches)) {
+		batches = b->next;
+		free_batch(b);
+	}
+	pending = 0;
+	destroy_share();
+	if(efd != -1) close(efd);
+	efd = -1;
+}
+
+struct engine thread_engine = {
+	.name = "thread",
+	.init = thread_init,
+	.start_cycle = thread_start_cycle,
+	.poll = thread_poll,
+	.set_concurrency = thread_set_concurrency,
+	.destroy = thread_destroy,
+};
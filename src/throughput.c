@@ -0,0 +1,253 @@
+/**
+ * throughput.c
+ *
+ * Toke Høiland-Jørgensen
+ * 2026-10-17
+ *
+ * Goodput sampling inside transfers. The progress callback is called by cURL
+ * whenever data comes in (and about once a second while none does), so a
+ * sample is taken on the first call after each interval has passed that has
+ * seen new bytes; a gap between two such calls is a stall. Everything else is
+ * worked out from the samples once the transfer is done.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "throughput.h"
+#include "stats.h"
+#include "transfer.h"
+#include "util.h"
+
+struct sample {
+	long long ns;
+	long bytes;
+};
+
+/* Times are in ns since the transfer started; first_ns is -1 until the first
+ * byte of the body is in. */
+struct throughput {
+	long long interval_ns;
+	long long step_ns;
+	long long next_ns;
+	long long first_ns;
+	long long last_ns;
+	long bytes;
+	int stalls;
+	long long stall_ns;
+	struct timespec start;
+	int count;
+	struct sample samples[THROUGHPUT_SAMPLES];
+};
+
+struct throughput_stats {
+	long long interval_ns;
+	int transfers;
+	int stalled;
+	int stalls;
+	long long stall_ns;
+	long peak_rate;
+	long curve_bytes[CURVE_WINDOWS];
+	long long curve_ns[CURVE_WINDOWS];
+	int curve_transfers[CURVE_WINDOWS];
+	struct histogram ramp_hist;
+};
+
+static struct throughput_stats totals;
+
+struct throughput *throughput_new(int interval_ms)
+{
+	struct throughput *tp = calloc(1, sizeof(*tp));
+	if(!tp) {
+		perror("calloc");
+		return NULL;
+	}
+	tp->interval_ns = (long long)interval_ms * 1000000;
+	throughput_reset(tp);
+	return tp;
+}
+
+void throughput_free(struct throughput *tp)
+{
+	free(tp);
+}
+
+void throughput_reset(struct throughput *tp)
+{
+	tp->step_ns = tp->interval_ns;
+	tp->next_ns = 0;
+	tp->first_ns = -1;
+	tp->last_ns = 0;
+	tp->bytes = 0;
+	tp->stalls = 0;
+	tp->stall_ns = 0;
+	tp->count = 0;
+	clock_gettime(CLOCK_MONOTONIC, &tp->start);
+}
+
+/* With the buffer full, keep every other sample (the first one included) and
+ * sample half as often from then on. */
+static void add_sample(struct throughput *tp, long long ns, long bytes)
+{
+	int i;
+
+	if(tp->count == THROUGHPUT_SAMPLES) {
+		for(i = 1; i < THROUGHPUT_SAMPLES / 2; i++)
+			tp->samples[i] = tp->samples[i * 2];
+		tp->count = THROUGHPUT_SAMPLES / 2;
+		tp->step_ns *= 2;
+	}
+	tp->samples[tp->count].ns = ns;
+	tp->samples[tp->count].bytes = bytes;
+	tp->count++;
+	tp->next_ns = ns + tp->step_ns;
+}
+
+/* The first sample is taken as the first bytes come in, and counts them as
+ * arriving during the first interval. */
+void throughput_update(struct throughput *tp, long bytes)
+{
+	struct timespec now;
+	long long ns;
+
+	if(bytes <= tp->bytes)
+		return;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ns = ts_diff_ns(&now, &tp->start);
+	if(tp->first_ns < 0) {
+		tp->first_ns = ns;
+		add_sample(tp, ns, 0);
+	} else if(ns - tp->last_ns >= STALL_INTERVALS * tp->interval_ns) {
+		tp->stalls++;
+		tp->stall_ns += ns - tp->last_ns;
+	}
+	tp->bytes = bytes;
+	tp->last_ns = ns;
+	if(ns >= tp->next_ns)
+		add_sample(tp, ns, bytes);
+}
+
+/* The curve window a time since the first byte falls in: the first is one
+ * interval long, and each one after that as long as all the ones before. */
+static int curve_window(long long ns, long long interval_ns)
+{
+	int w = 0;
+
+	while(ns >= interval_ns && w < CURVE_WINDOWS - 1) {
+		ns /= 2;
+		w++;
+	}
+	return w;
+}
+
+static long long window_start(int w, long long interval_ns)
+{
+	return w ? interval_ns << (w - 1) : 0;
+}
+
+static long rate(long bytes, long long ns)
+{
+	return ns > 0 ? (long)(bytes * 1e9 / ns) : 0;
+}
+
+void throughput_result(struct throughput *tp, struct result *r)
+{
+	const struct sample *s = tp->samples, *half;
+	long steady, d;
+	int i;
+
+	r->samples = 0;
+	r->stalls = tp->stalls;
+	r->stall_ns = tp->stall_ns;
+	r->body_ns = 0;
+	r->ramp_ns = -1;
+	r->peak_rate = 0;
+	memset(r->curve, 0, sizeof(r->curve));
+	if(tp->first_ns < 0)
+		return;
+	if(s[tp->count - 1].bytes < tp->bytes)
+		add_sample(tp, tp->last_ns, tp->bytes);
+
+	r->samples = tp->count;
+	r->body_ns = tp->last_ns - tp->first_ns;
+	/* The bytes between two samples go in the window halfway between
+	 * them. */
+	for(i = 1; i < tp->count; i++) {
+		d = s[i].bytes - s[i - 1].bytes;
+		r->curve[curve_window((s[i - 1].ns + s[i].ns) / 2 - tp->first_ns, tp->interval_ns)] += d;
+		r->peak_rate = max(r->peak_rate, rate(d, s[i].ns - s[i - 1].ns));
+	}
+	if(tp->count < RAMP_MIN_SAMPLES)
+		return;
+
+	/* With nothing after the half-way sample, there is no steady rate to
+	 * ramp up to. */
+	for(half = s; half->ns - tp->first_ns < r->body_ns / 2; half++);
+	if(half == &s[tp->count - 1])
+		return;
+	steady = rate(tp->bytes - half->bytes, tp->last_ns - half->ns);
+	for(i = 1; i < tp->count; i++) {
+		if(rate(s[i].bytes - s[i - 1].bytes, s[i].ns - s[i - 1].ns) >= steady * RAMP_FRACTION) {
+			r->ramp_ns = s[i].ns - tp->first_ns;
+			break;
+		}
+	}
+}
+
+void throughput_stats_init(int interval_ms)
+{
+	memset(&totals, 0, sizeof(totals));
+	totals.interval_ns = (long long)interval_ms * 1000000;
+}
+
+/* Each transfer adds its bytes to the curve windows, and the part of its body
+ * time that falls in each of them. A body that came in all at once has no
+ * goodput to speak of. */
+void throughput_stats_add(const struct result *r)
+{
+	long long start, end;
+	int w;
+
+	if(r->url < 0 || r->status || r->body_ns <= 0)
+		return;
+	totals.transfers++;
+	if(r->stalls)
+		totals.stalled++;
+	totals.stalls += r->stalls;
+	totals.stall_ns += r->stall_ns;
+	totals.peak_rate = max(totals.peak_rate, r->peak_rate);
+	for(w = 0; w < CURVE_WINDOWS; w++) {
+		start = window_start(w, totals.interval_ns);
+		end = w < CURVE_WINDOWS - 1 ? window_start(w + 1, totals.interval_ns) : r->body_ns;
+		if(r->body_ns < start || (r->body_ns == start && w))
+			break;
+		totals.curve_bytes[w] += r->curve[w];
+		totals.curve_ns[w] += min(r->body_ns, end) - start;
+		totals.curve_transfers[w]++;
+	}
+	if(r->ramp_ns >= 0)
+		hist_record(&totals.ramp_hist, r->ramp_ns / 1000);
+}
+
+void throughput_stats_print(FILE *output)
+{
+	int w;
+
+	fprintf(output, "Sampled goodput of %d transfers every %lld ms, peaking at %.2f Mbit/s. %d stalls in %d transfers, for %.3f ms in all.\n",
+		totals.transfers, totals.interval_ns / 1000000, totals.peak_rate * 8 / 1e6,
+		totals.stalls, totals.stalled, totals.stall_ns / 1e6);
+	if(!totals.transfers)
+		return;
+	fprintf(output, "Goodput by time since first byte:\n");
+	for(w = 0; w < CURVE_WINDOWS && totals.curve_transfers[w]; w++) {
+		fprintf(output, "  %9.1f - ", window_start(w, totals.interval_ns) / 1e6);
+		if(w < CURVE_WINDOWS - 1)
+			fprintf(output, "%9.1f ms:", window_start(w + 1, totals.interval_ns) / 1e6);
+		else
+			fprintf(output, "%9s ms:", "");
+		fprintf(output, " %10.2f Mbit/s (%d transfers)\n",
+			rate(totals.curve_bytes[w], totals.curve_ns[w]) * 8 / 1e6, totals.curve_transfers[w]);
+	}
+	if(totals.ramp_hist.count)
+		hist_print(output, "Ramp-up time", &totals.ramp_hist);
+}
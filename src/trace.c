@@ -0,0 +1,154 @@
+/**
+ * trace.c
+ *
+ * Toke Høiland-Jørgensen
+ * 2026-10-17
+ *
+ * Request traces: recorded through a large stdio buffer as results come in,
+ * and mapped into memory for replay, so that a trace of tens of millions of
+ * requests costs no more than its page cache footprint to read.
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include "trace.h"
+#include "util.h"
+
+#define TRACE_BUFSIZE (1 << 20)
+
+static FILE *out = NULL;
+static char buffer[TRACE_BUFSIZE];
+
+int trace_record_open(const char *path)
+{
+	struct trace_header h;
+	struct timeval now;
+
+	if(!(out = fopen(path, "w"))) {
+		perror("Unable to open trace file");
+		return -1;
+	}
+	if(setvbuf(out, buffer, _IOFBF, sizeof(buffer))) {
+		perror("setvbuf()");
+		fclose(out);
+		out = NULL;
+		return -1;
+	}
+	gettimeofday(&now, NULL);
+	memset(&h, 0, sizeof(h));
+	h.magic = TRACE_MAGIC;
+	h.version = TRACE_VERSION;
+	h.entry_size = sizeof(struct trace_entry);
+	h.start = (int64_t)now.tv_sec * 1000000 + now.tv_usec;
+	fwrite(&h, sizeof(h), 1, out);
+	return 0;
+}
+
+/* The URL list fetches are not part of the trace. */
+void trace_record(const struct result *r, const struct timespec *start)
+{
+	struct trace_entry e;
+
+	if(!out || r->url < 0)
+		return;
+	memset(&e, 0, sizeof(e));
+	e.offset_ns = ts_diff_ns(&r->started, start);
+	e.url = r->url;
+	e.worker = r->worker;
+	e.status = r->status;
+	e.code = r->code;
+	e.duration_us = r->times[TIME_TOTAL];
+	fwrite(&e, sizeof(e), 1, out);
+}
+
+void trace_record_close()
+{
+	if(!out)
+		return;
+	if(fclose(out))
+		perror("Unable to write trace file");
+	out = NULL;
+}
+
+static const struct trace_entry *sort_entries;
+
+static int order_cmp(const void *a, const void *b)
+{
+	const struct trace_entry *ea = &sort_entries[*(const uint32_t *)a];
+	const struct trace_entry *eb = &sort_entries[*(const uint32_t *)b];
+	return (ea->offset_ns > eb->offset_ns) - (ea->offset_ns < eb->offset_ns);
+}
+
+/* Map a trace read-only. The entries are used where they are; only if they
+ * are out of order is an index of them sorted (4 bytes per entry). */
+int trace_map(struct trace *t, const char *path)
+{
+	const struct trace_header *h;
+	struct stat st;
+	size_t i;
+	int fd;
+
+	memset(t, 0, sizeof(*t));
+	if((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0 || fstat(fd, &st) < 0) {
+		perror("Unable to open trace file");
+		if(fd >= 0) close(fd);
+		return -1;
+	}
+	if(st.st_size < sizeof(*h)) {
+		fprintf(stderr, "Not a trace file: %s\n", path);
+		close(fd);
+		return -1;
+	}
+	t->map_len = st.st_size;
+	t->map = mmap(NULL, t->map_len, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(t->map == MAP_FAILED) {
+		perror("mmap()");
+		t->map = NULL;
+		return -1;
+	}
+	h = t->map;
+	if(h->magic != TRACE_MAGIC || h->version != TRACE_VERSION || h->entry_size != sizeof(struct trace_entry)) {
+		fprintf(stderr, "Not a trace file (or of another version or byte order): %s\n", path);
+		goto err;
+	}
+	t->entries = (const struct trace_entry *)(h + 1);
+	t->count = (t->map_len - sizeof(*h)) / sizeof(struct trace_entry);
+	if(t->count > UINT32_MAX) {
+		fprintf(stderr, "Trace too large: %s\n", path);
+		goto err;
+	}
+
+	for(i = 1; i < t->count && t->entries[i].offset_ns >= t->entries[i-1].offset_ns; i++);
+	if(i >= t->count) {
+		madvise(t->map, t->map_len, MADV_SEQUENTIAL);
+		return 0;
+	}
+	if(!(t->order = malloc(t->count * sizeof(*t->order)))) {
+		perror("malloc");
+		goto err;
+	}
+	for(i = 0; i < t->count; i++)
+		t->order[i] = i;
+	sort_entries = t->entries;
+	qsort(t->order, t->count, sizeof(*t->order), order_cmp);
+	return 0;
+
+err:
+	trace_unmap(t);
+	return -1;
+}
+
+void trace_unmap(struct trace *t)
+{
+	if(t->map)
+		munmap(t->map, t->map_len);
+	free(t->order);
+	memset(t, 0, sizeof(*t));
+}
@@ -0,0 +1,336 @@
+/**
+ * transfer.c
+ *
+ * Toke Høiland-Jørgensen
+ * 2026-10-17
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "transfer.h"
+#include "crc32c.h"
+#include "decode.h"
+#include "throughput.h"
+#include "util.h"
+
+/* DNS and TLS session caches shared by every handle in this process when
+ * running in keep-alive mode. The locks are only contended with the thread
+ * engine. Connections are not shared: libcurl does not support a shared
+ * connection cache being used by handles in several threads at once, and as
+ * every engine keeps its handles across cycles with -k, each handle's own
+ * connection cache already keeps its connections warm. */
+static CURLSH *share = NULL;
+static pthread_mutex_t share_locks[CURL_LOCK_DATA_LAST];
+
+static void share_lock(CURL *curl, curl_lock_data data, curl_lock_access access, void *userp)
+{
+	pthread_mutex_lock(&share_locks[data]);
+}
+
+static void share_unlock(CURL *curl, curl_lock_data data, void *userp)
+{
+	pthread_mutex_unlock(&share_locks[data]);
+}
+
+static CURLSH *get_share()
+{
+	int i;
+	if(share)
+		return share;
+	share = curl_share_init();
+	if(!share)
+		return NULL;
+	for(i = 0; i < CURL_LOCK_DATA_LAST; i++)
+		pthread_mutex_init(&share_locks[i], NULL);
+	if(curl_share_setopt(share, CURLSHOPT_LOCKFUNC, share_lock) != CURLSHE_OK ||
+	   curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC, share_unlock) != CURLSHE_OK ||
+	   curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS) != CURLSHE_OK ||
+	   curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION) != CURLSHE_OK) {
+		fprintf(stderr, "Unable to set up cURL share handle.\n");
+		destroy_share();
+	}
+	return share;
+}
+
+void destroy_share()
+{
+	if(share) curl_share_cleanup(share);
+	share = NULL;
+}
+
+static const long http_versions[] = {
+	[HTTP_VERSION_DEFAULT] = CURL_HTTP_VERSION_NONE,
+	[HTTP_VERSION_1_1] = CURL_HTTP_VERSION_1_1,
+	[HTTP_VERSION_2] = CURL_HTTP_VERSION_2_0,
+	[HTTP_VERSION_2_PRIOR] = CURL_HTTP_VERSION_2_PRIOR_KNOWLEDGE,
+	[HTTP_VERSION_3] = CURL_HTTP_VERSION_3,
+};
+
+/* Where the body goes once it is decoded. */
+static int body_sink(void *ctx, const void *buf, size_t len)
+{
+	struct transfer_data *td = ctx;
+	if(td->urls)
+		return url_table_feed(td->urls, buf, len);
+	if(td->verify)
+		td->digest = crc32c(td->digest, buf, len);
+	return 0;
+}
+
+size_t write_callback(void *contents, size_t size, size_t nmemb, void *userp)
+{
+	size_t realsize = size * nmemb;
+	struct transfer_data *td = userp;
+	struct curl_header *h;
+
+	if(!td->dec)
+		return body_sink(td, contents, realsize) ? 0 : realsize;
+	if(!decoder_started(td->dec) &&
+	   decoder_start(td->dec, curl_easy_header(td->curl, "Content-Encoding", 0, CURLH_HEADER, -1, &h) == CURLHE_OK ?
+			 h->value : NULL)) {
+		fprintf(stderr, "Unable to set up content decoding.\n");
+		return 0;
+	}
+	return decoder_write(td->dec, contents, realsize, body_sink, td) ? 0 : realsize;
+}
+
+static int xferinfo_callback(void *clientp, curl_off_t dltotal, curl_off_t dlnow,
+			     curl_off_t ultotal, curl_off_t ulnow)
+{
+	struct transfer_data *td = clientp;
+	if(td->tp)
+		throughput_update(td->tp, (long)dlnow);
+	return td->cancelled ? td->cancelled(td->cancel_ctx) : 0;
+}
+
+/* Set the options common to every transfer handle, regardless of which engine
+ * drives it. */
+int setup_handle(CURL *curl, struct options *opt, struct transfer_data *td)
+{
+	int res = 0;
+	td->curl = curl;
+	td->verify = opt->verify;
+	td->digest = 0;
+	if(opt->encodings && !td->dec && !(td->dec = decoder_new()))
+		return CURLE_OUT_OF_MEMORY;
+	if(opt->throughput_interval && !td->tp && !(td->tp = throughput_new(opt->throughput_interval)))
+		return CURLE_OUT_OF_MEMORY;
+	if(opt->debug > 1 && (res = curl_easy_setopt(curl, CURLOPT_VERBOSE, 1L)) != CURLE_OK) {
+		fprintf(stderr, "cURL VERBOSE option error: %s\n", curl_easy_strerror(res));
+		goto out;
+	}
+
+	if((res = curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L)) != CURLE_OK) {
+		fprintf(stderr, "cURL FOLLOWLOCATION option error: %s\n", curl_easy_strerror(res));
+		goto out;
+	}
+	if(opt->timeout && (res = curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, opt->timeout)) != CURLE_OK) {
+		fprintf(stderr, "cURL TIMEOUT_MS option error: %s\n", curl_easy_strerror(res));
+		goto out;
+	}
+	if(opt->http_version && (res = curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, http_versions[opt->http_version])) != CURLE_OK) {
+		fprintf(stderr, "cURL HTTP_VERSION option error: %s\n", curl_easy_strerror(res));
+		goto out;
+	}
+	/* Wait for a connection that can be multiplexed onto rather than
+	 * opening a new one for every concurrent transfer. */
+	if(opt->http_version >= HTTP_VERSION_2 && (res = curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L)) != CURLE_OK) {
+		fprintf(stderr, "cURL PIPEWAIT option error: %s\n", curl_easy_strerror(res));
+		goto out;
+	}
+	if((res = curl_easy_setopt(curl, CURLOPT_TCP_NODELAY, 1L)) != CURLE_OK) {
+		fprintf(stderr, "cURL TCP_NODELAY option error: %s\n", curl_easy_strerror(res));
+		goto out;
+	}
+
+	if(opt->dns_servers && (res = curl_easy_setopt(curl, CURLOPT_DNS_SERVERS, opt->dns_servers)) != CURLE_OK) {
+		fprintf(stderr, "cURL DNS_SERVERS option error: %s\n", curl_easy_strerror(res));
+		goto out;
+	}
+
+	if(opt->ai_family == AF_INET && (res = curl_easy_setopt(curl, CURLOPT_IPRESOLVE, CURL_IPRESOLVE_V4)) != CURLE_OK) {
+		fprintf(stderr, "cURL IPRESOLVE (v4) option error: %s\n", curl_easy_strerror(res));
+		goto out;
+	}
+	if(opt->ai_family == AF_INET6 && (res = curl_easy_setopt(curl, CURLOPT_IPRESOLVE, CURL_IPRESOLVE_V6)) != CURLE_OK) {
+		fprintf(stderr, "cURL IPRESOLVE (v6) option error: %s\n", curl_easy_strerror(res));
+		goto out;
+	}
+
+	/* Decoding is left to the write callback, which times it. */
+	if(opt->encodings) {
+		if((res = curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, opt->encodings)) != CURLE_OK) {
+			fprintf(stderr, "cURL ACCEPT_ENCODING option error: %s\n", curl_easy_strerror(res));
+			goto out;
+		}
+		if((res = curl_easy_setopt(curl, CURLOPT_HTTP_CONTENT_DECODING, 0L)) != CURLE_OK) {
+			fprintf(stderr, "cURL HTTP_CONTENT_DECODING option error: %s\n", curl_easy_strerror(res));
+			goto out;
+		}
+	}
+
+	/* send all data to this function  */
+	if((res = curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback)) != CURLE_OK) {
+		fprintf(stderr, "cURL WRITEFUNCTION option error: %s\n", curl_easy_strerror(res));
+		goto out;
+	}
+
+
+	/* we pass our transfer data to the callback function */
+	if((res = curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)td)) != CURLE_OK) {
+		fprintf(stderr, "cURL WRITEDATA option error: %s\n", curl_easy_strerror(res));
+		goto out;
+	}
+
+
+	if(opt->keepalive) {
+		if(!get_share()) {
+			res = CURLE_FAILED_INIT;
+			fprintf(stderr, "cURL SHARE option error: %s\n", curl_easy_strerror(res));
+			goto out;
+		}
+		if((res = curl_easy_setopt(curl, CURLOPT_SHARE, share)) != CURLE_OK) {
+			fprintf(stderr, "cURL SHARE option error: %s\n", curl_easy_strerror(res));
+			goto out;
+		}
+	}
+
+	if(td->tp || td->cancelled) {
+		if((res = curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, xferinfo_callback)) != CURLE_OK ||
+		   (res = curl_easy_setopt(curl, CURLOPT_XFERINFODATA, td)) != CURLE_OK ||
+		   (res = curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L)) != CURLE_OK) {
+			fprintf(stderr, "cURL XFERINFOFUNCTION option error: %s\n", curl_easy_strerror(res));
+			goto out;
+		}
+	}
+
+	/* some servers don't like requests that are made without a user-agent
+	   field, so we provide one */
+	if((res = curl_easy_setopt(curl, CURLOPT_USERAGENT, "http-getter/0.1")) != CURLE_OK) {
+		fprintf(stderr, "cURL USERAGENT option error: %s\n", curl_easy_strerror(res));
+		goto out;
+	}
+
+out:
+	return res;
+}
+
+void transfer_start(struct transfer_data *td)
+{
+	td->digest = 0;
+	if(td->dec)
+		decoder_reset(td->dec);
+	if(td->tp)
+		throughput_reset(td->tp);
+}
+
+/* Returns the status of the result, which a truncated body makes an error. */
+int transfer_result(struct transfer_data *td, struct result *r)
+{
+	r->digest = td->digest;
+	if(td->dec)
+		decoder_result(td->dec, r);
+	if(td->tp)
+		throughput_result(td->tp, r);
+	return r->status;
+}
+
+void transfer_data_destroy(struct transfer_data *td)
+{
+	decoder_free(td->dec);
+	throughput_free(td->tp);
+	td->dec = NULL;
+	td->tp = NULL;
+}
+
+/* Limit the next transfer on a handle to left_ms (the time left until its
+ * cycle's deadline, 0 if none) as well as to the -t timeout. */
+void set_transfer_timeout(CURL *curl, struct options *opt, long left_ms)
+{
+	long ms = opt->timeout;
+	if(left_ms && (!ms || left_ms < ms))
+		ms = left_ms;
+	curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, ms);
+}
+
+int get_result(CURL *curl, struct result *r)
+{
+	static const CURLINFO infos[NUM_TIMES] = {
+		[TIME_NAMELOOKUP] = CURLINFO_NAMELOOKUP_TIME_T,
+		[TIME_CONNECT] = CURLINFO_CONNECT_TIME_T,
+		[TIME_APPCONNECT] = CURLINFO_APPCONNECT_TIME_T,
+		[TIME_STARTTRANSFER] = CURLINFO_STARTTRANSFER_TIME_T,
+		[TIME_TOTAL] = CURLINFO_TOTAL_TIME_T,
+	};
+	curl_off_t bytes = 0;
+	long header_bytes = 0;
+	int res, i;
+
+	if((res = curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD_T, &bytes)) != CURLE_OK ||
+	   (res = curl_easy_getinfo(curl, CURLINFO_HEADER_SIZE, &header_bytes)) != CURLE_OK ||
+	   (res = curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &r->connects)) != CURLE_OK ||
+	   (res = curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &r->code)) != CURLE_OK)
+		goto err;
+	r->bytes = (long)bytes + header_bytes;
+
+	for(i = 0; i < NUM_TIMES; i++) {
+		r->times[i] = 0;
+		if((res = curl_easy_getinfo(curl, infos[i], &r->times[i])) != CURLE_OK)
+			goto err;
+	}
+	return 0;
+
+err:
+	fprintf(stderr, "cURL error: %s\n", curl_easy_strerror(res));
+	return res;
+}
+
+/* An empty result; with no goodput samples, there is no ramp-up time either. */
+void result_init(struct result *r)
+{
+	memset(r, 0, sizeof(*r));
+	r->ramp_ns = -1;
+}
+
+/* Add us to the time to the first byte and the total time of a result. A
+ * hedge that won is measured from when the original request was issued, which
+ * is the latency a user would see; the time it waited is taken as time waiting
+ * for the server, and the DNS, connect and TLS times stay what they were. */
+void result_delay(struct result *r, curl_off_t us)
+{
+	r->times[TIME_STARTTRANSFER] += us;
+	r->times[TIME_TOTAL] += us;
+}
+
+/* Conditional request headers for revalidating a cached URL list. */
+struct curl_slist *list_request_headers(const char *etag, const char *last_modified)
+{
+	struct curl_slist *headers = NULL;
+	char buf[1024];
+	if(etag) {
+		snprintf(buf, sizeof(buf), "If-None-Match: %s", etag);
+		headers = curl_slist_append(headers, buf);
+	}
+	if(last_modified) {
+		snprintf(buf, sizeof(buf), "If-Modified-Since: %s", last_modified);
+		headers = curl_slist_append(headers, buf);
+	}
+	return headers;
+}
+
+/* Return the HTTP status of a URL list fetch, and its cache validators (which
+ * stay valid until the handle is reused). */
+long get_list_validators(CURL *curl, const char **etag, const char **last_modified)
+{
+	struct curl_header *h;
+	long code = 0;
+
+	curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
+	*etag = *last_modified = NULL;
+	if(curl_easy_header(curl, "ETag", 0, CURLH_HEADER, -1, &h) == CURLHE_OK)
+		*etag = h->value;
+	if(curl_easy_header(curl, "Last-Modified", 0, CURLH_HEADER, -1, &h) == CURLHE_OK)
+		*last_modified = h->value;
+	return code;
+}
@@ -0,0 +1,250 @@
+/**
+ * urls.c
+ *
+ * Toke Høiland-Jørgensen
+ * 2026-10-17
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "urls.h"
+#include "listcache.h"
+
+#define ARENA_MIN 4096
+#define OFFSETS_MIN 64
+#define READ_BLOCK (1 << 20)
+
+void url_table_init(struct url_table *t)
+{
+	memset(t, 0, sizeof(*t));
+}
+
+void url_table_destroy(struct url_table *t)
+{
+	free(t->arena);
+	free(t->offsets);
+	url_table_init(t);
+}
+
+/* Empty the table but keep its allocations for reuse. */
+void url_table_reset(struct url_table *t)
+{
+	t->arena_len = 0;
+	t->pending = 0;
+	t->count = 0;
+}
+
+struct url_table *url_table_new()
+{
+	struct url_table *t = malloc(sizeof(*t));
+	if(!t) {
+		perror("malloc");
+		return NULL;
+	}
+	url_table_init(t);
+	return t;
+}
+
+void url_table_free(struct url_table *t)
+{
+	if(!t) return;
+	url_table_destroy(t);
+	free(t);
+}
+
+static int arena_reserve(struct url_table *t, size_t len)
+{
+	size_t size = t->arena_size ? t->arena_size : ARENA_MIN;
+	char *arena;
+	if(t->arena_len + len <= t->arena_size)
+		return 0;
+	while(size < t->arena_len + len) size *= 2;
+	arena = realloc(t->arena, size);
+	if(!arena) {
+		perror("realloc");
+		return -1;
+	}
+	t->arena = arena;
+	t->arena_size = size;
+	return 0;
+}
+
+static int offsets_reserve(struct url_table *t)
+{
+	size_t *offsets;
+	if(t->count == t->size) {
+		offsets = realloc(t->offsets, (t->size ? t->size * 2 : OFFSETS_MIN) * sizeof(*offsets));
+		if(!offsets) {
+			perror("realloc");
+			return -1;
+		}
+		t->offsets = offsets;
+		t->size = t->size ? t->size * 2 : OFFSETS_MIN;
+	}
+	return 0;
+}
+
+int url_table_add(struct url_table *t, const char *url, size_t len)
+{
+	if(offsets_reserve(t) || arena_reserve(t, len + 1))
+		return -1;
+	memcpy(t->arena + t->arena_len, url, len);
+	t->arena[t->arena_len + len] = '\0';
+	t->offsets[t->count++] = t->arena_len;
+	t->arena_len += len + 1;
+	return 0;
+}
+
+/* Turn the pending bytes at the end of the arena into a table entry, unless
+ * they make up an empty line or a comment. */
+static int commit_line(struct url_table *t)
+{
+	char *line = t->arena + t->arena_len;
+	size_t len = t->pending;
+
+	t->pending = 0;
+	if(len && line[len-1] == '\r') len--;
+	if(!len || *line == '#')
+		return 0;
+	if(offsets_reserve(t))
+		return -1;
+	line[len] = '\0';
+	t->offsets[t->count++] = t->arena_len;
+	t->arena_len += len + 1;
+	return 0;
+}
+
+/* Add the lines in buf to the table as they stream in: complete lines are
+ * committed straight away, and a trailing partial line stays pending at the
+ * end of the arena until the rest of it arrives. Every byte is copied exactly
+ * once, and newlines are found with memchr(). */
+int url_table_feed(struct url_table *t, const char *buf, size_t len)
+{
+	const char *p = buf, *end = buf + len, *eol;
+	size_t l;
+
+	while(p < end) {
+		eol = memchr(p, '\n', end - p);
+		l = (eol ? eol : end) - p;
+		if(arena_reserve(t, t->pending + l + 1))
+			return -1;
+		memcpy(t->arena + t->arena_len + t->pending, p, l);
+		t->pending += l;
+		if(!eol)
+			break;
+		if(commit_line(t))
+			return -1;
+		p = eol + 1;
+	}
+	return 0;
+}
+
+/* Commit a final line without a trailing newline. */
+int url_table_finish(struct url_table *t)
+{
+	return t->pending ? commit_line(t) : 0;
+}
+
+/* Add every line in buf to the table, skipping empty lines and lines starting
+ * with '#'. A final line without a trailing newline is included. */
+int url_table_parse(struct url_table *t, const char *buf, size_t len)
+{
+	if(!buf) return 0;
+	if(arena_reserve(t, len + 1) ||
+	   url_table_feed(t, buf, len) ||
+	   url_table_finish(t))
+		return -1;
+	return 0;
+}
+
+/* Take over an arena of len bytes of NUL-terminated strings (as produced by
+ * another table) and rebuild the offset index for it. */
+int url_table_adopt(struct url_table *t, char *arena, size_t len, size_t size)
+{
+	char *p = arena, *end = arena + len;
+	url_table_destroy(t);
+	t->arena = arena;
+	t->arena_len = len;
+	t->arena_size = size;
+	while(p < end) {
+		if(offsets_reserve(t))
+			return -1;
+		t->offsets[t->count++] = p - arena;
+		p = memchr(p, '\0', end - p);
+		if(!p) break;
+		p++;
+	}
+	return 0;
+}
+
+int url_table_load(struct url_table *t, FILE *f)
+{
+	char *buf = NULL, *nbuf;
+	size_t len = 0, size = 0, r;
+	int ret;
+
+	do {
+		if(size - len < READ_BLOCK) {
+			size = size ? size * 2 : READ_BLOCK;
+			nbuf = realloc(buf, size);
+			if(!nbuf) {
+				perror("realloc");
+				free(buf);
+				return -1;
+			}
+			buf = nbuf;
+		}
+		r = fread(buf + len, 1, size - len, f);
+		len += r;
+	} while(r > 0);
+
+	if(ferror(f)) {
+		perror("Unable to read url file");
+		free(buf);
+		return -1;
+	}
+	ret = url_table_parse(t, buf, len);
+	free(buf);
+	return ret;
+}
+
+/* Cut line i of the table off at the first white space, and return what came
+ * after it (the fields given with the URL), or NULL if nothing did. The fields
+ * stay in the arena after the URL, up to where the next line starts, so this
+ * gives the same answer when it is done again. */
+char *url_table_fields(struct url_table *t, size_t i)
+{
+	char *line = t->arena + t->offsets[i];
+	char *end = t->arena + (i + 1 < t->count ? t->offsets[i+1] : t->arena_len) - 1;
+	char *p = line + strcspn(line, " \t");
+
+	if(p >= end)
+		return NULL;
+	*p = '\0';
+	while(p < end && (!*p || *p == ' ' || *p == '\t'))
+		p++;
+	return p < end ? p : NULL;
+}
+
+int table_ref_newer(const struct table_ref *ref, const struct url_table *t, int cycle)
+{
+	return t && t != ref->table && cycle >= ref->cycle;
+}
+
+void table_ref_set(struct table_ref *ref, const struct url_table *t, struct url_list *l, int cycle)
+{
+	if(l)
+		l->refs++;
+	url_list_put(ref->list);
+	ref->list = l;
+	ref->table = t;
+	ref->cycle = cycle;
+}
+
+void table_ref_clear(struct table_ref *ref)
+{
+	url_list_put(ref->list);
+	ref->list = NULL;
+	ref->table = NULL;
+	ref->cycle = -1;
+}
@@ -0,0 +1,259 @@
+/**
+ * urlstats.c
+ *
+ * Toke Høiland-Jørgensen
+ * 2026-10-17
+ *
+ * Per-URL and per-host totals. Results are added by their index into the URL
+ * table, so the hot path is an array lookup and a histogram bucket increment;
+ * the mapping from URLs to hosts is worked out once per URL table. When a
+ * fetched URL list changes, the per-URL table starts over, while the hosts
+ * keep their totals across lists.
+ */
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <curl/curl.h>
+#include "urlstats.h"
+#include "output.h"
+#include "util.h"
+
+#define TOP_URLS 20
+
+struct host_stats {
+	char *name;
+	struct url_stats s;
+};
+
+struct url_host {
+	char *host;
+	size_t url;
+};
+
+static struct table_ref ref = TABLE_REF_INIT;
+static struct url_stats *urls = NULL;
+static int *url_hosts = NULL;
+static size_t nurls = 0;
+static struct host_stats *hosts = NULL;
+static int nhosts = 0;
+
+static int url_host_cmp(const void *a, const void *b)
+{
+	return strcmp(((const struct url_host *)a)->host, ((const struct url_host *)b)->host);
+}
+
+static int find_host(const char *name)
+{
+	struct host_stats *h;
+	int i;
+
+	for(i = 0; i < nhosts; i++) {
+		if(!strcmp(hosts[i].name, name))
+			return i;
+	}
+	if(!(h = realloc(hosts, (nhosts + 1) * sizeof(*hosts))))
+		return -1;
+	hosts = h;
+	memset(&hosts[nhosts], 0, sizeof(*hosts));
+	if(!(hosts[nhosts].name = strdup(name)))
+		return -1;
+	return nhosts++;
+}
+
+/* Map every URL of the table to its host. The names are sorted so that each
+ * host is only looked up once. URLs that cannot be parsed get no host. */
+static int map_hosts(const struct url_table *t)
+{
+	struct url_host *pairs;
+	CURLU *u;
+	char *host;
+	size_t i, n = 0;
+	int h = -1;
+
+	if(!(pairs = calloc(t->count, sizeof(*pairs))) || !(u = curl_url())) {
+		free(pairs);
+		return -1;
+	}
+	for(i = 0; i < t->count; i++) {
+		url_hosts[i] = -1;
+		host = NULL;
+		if(curl_url_set(u, CURLUPART_URL, url_get(t, i), 0) == CURLUE_OK &&
+		   curl_url_get(u, CURLUPART_HOST, &host, 0) == CURLUE_OK) {
+			pairs[n].host = host;
+			pairs[n++].url = i;
+		}
+	}
+	curl_url_cleanup(u);
+
+	qsort(pairs, n, sizeof(*pairs), url_host_cmp);
+	for(i = 0; i < n; i++) {
+		if(!i || strcmp(pairs[i].host, pairs[i-1].host))
+			h = find_host(pairs[i].host);
+		url_hosts[pairs[i].url] = h;
+	}
+	for(i = 0; i < n; i++)
+		curl_free(pairs[i].host);
+	free(pairs);
+	return 0;
+}
+
+/* Start the per-URL table over for the URL table of cycle c. */
+static int set_table(const struct cycle *c)
+{
+	struct url_stats *s;
+	int *h;
+
+	if(!(s = calloc(c->urls->count, sizeof(*s))) ||
+	   !(h = calloc(c->urls->count, sizeof(*h)))) {
+		perror("Unable to allocate URL statistics");
+		free(s);
+		return -1;
+	}
+	free(urls);
+	free(url_hosts);
+	urls = s;
+	url_hosts = h;
+	nurls = c->urls->count;
+	if(map_hosts(c->urls))
+		fprintf(stderr, "Unable to map URLs to hosts.\n");
+	table_ref_set(&ref, c->urls, c->list, c->id);
+	return 0;
+}
+
+static void stats_add(struct url_stats *s, const struct result *r)
+{
+	if(r->status) {
+		s->errors++;
+		return;
+	}
+	s->requests++;
+	s->bytes += r->bytes;
+	s->time_sum += r->times[TIME_TOTAL];
+	chist_record(&s->hist, r->times[TIME_TOTAL]);
+}
+
+/* Results of a cycle that still runs on an older URL list than the newest one
+ * seen are left out, as are transfers cut short by the deadline, which the
+ * cycle counts as missed rather than failed. */
+void url_stats_add(const struct cycle *c, const struct result *r)
+{
+	int h;
+
+	if(r->url < 0 || !c->urls || deadline_missed(&c->deadline, r->status))
+		return;
+	if(table_ref_newer(&ref, c->urls, c->id) && set_table(c))
+		return;
+	if(c->urls != ref.table)
+		return;
+	stats_add(&urls[r->url], r);
+	if((h = url_hosts[r->url]) >= 0)
+		stats_add(&hosts[h].s, r);
+}
+
+struct sort_entry {
+	uint64_t p99;
+	int idx;
+};
+
+static int sort_entry_cmp(const void *a, const void *b)
+{
+	const struct sort_entry *ea = a, *eb = b;
+	if(ea->p99 != eb->p99)
+		return ea->p99 < eb->p99 ? 1 : -1;
+	return ea->idx - eb->idx;
+}
+
+/* Indexes of the entries with samples, slowest (by 99th percentile) first. */
+static struct sort_entry *sorted(const void *base, size_t size, size_t offset, size_t count, size_t *n)
+{
+	const struct url_stats *s;
+	struct sort_entry *e;
+	size_t i;
+
+	*n = 0;
+	if(!count || !(e = malloc(count * sizeof(*e))))
+		return NULL;
+	for(i = 0; i < count; i++) {
+		s = (const struct url_stats *)((const char *)base + i * size + offset);
+		if(!s->requests && !s->errors)
+			continue;
+		e[*n].p99 = chist_percentile(&s->hist, 99);
+		e[(*n)++].idx = i;
+	}
+	qsort(e, *n, sizeof(*e), sort_entry_cmp);
+	return e;
+}
+
+static void print_line(FILE *output, const char *name, const struct url_stats *s)
+{
+	fprintf(output, "  %8u %6u %12lu %9.3f %9.3f %9.3f %9.3f %9.3f  %s\n",
+		s->requests, s->errors, (unsigned long)s->bytes,
+		(double)s->time_sum / max(s->requests, 1) / 1000,
+		(double)chist_percentile(&s->hist, 50) / 1000,
+		(double)chist_percentile(&s->hist, 90) / 1000,
+		(double)chist_percentile(&s->hist, 99) / 1000,
+		(double)s->hist.max / 1000, name);
+}
+
+static void print_header(FILE *output, const char *title)
+{
+	fprintf(output, "\n%s:\n  %8s %6s %12s %9s %9s %9s %9s %9s\n", title,
+		"requests", "errors", "bytes", "avg ms", "p50 ms", "p90 ms", "p99 ms", "max ms");
+}
+
+/* Every host, and the slowest URLs, by 99th percentile of the request time. */
+void url_stats_print(FILE *output)
+{
+	struct sort_entry *e;
+	char title[64];
+	size_t i, n;
+
+	if((e = sorted(hosts, sizeof(*hosts), offsetof(struct host_stats, s), nhosts, &n)) && n) {
+		print_header(output, "Hosts by p99 request time");
+		for(i = 0; i < n; i++)
+			print_line(output, hosts[e[i].idx].name, &hosts[e[i].idx].s);
+	}
+	free(e);
+	if((e = sorted(urls, sizeof(*urls), 0, nurls, &n)) && n) {
+		if(n > TOP_URLS)
+			snprintf(title, sizeof(title), "Slowest %d of %lu URLs by p99 request time", TOP_URLS, (unsigned long)n);
+		else
+			snprintf(title, sizeof(title), "URLs by p99 request time");
+		print_header(output, title);
+		for(i = 0; i < min(n, TOP_URLS); i++)
+			print_line(output, url_get(ref.table, e[i].idx), &urls[e[i].idx]);
+	}
+	free(e);
+}
+
+/* Records for every host and URL with samples, in table order. */
+void url_stats_output()
+{
+	size_t i;
+	int h;
+	for(h = 0; h < nhosts; h++) {
+		if(hosts[h].s.requests || hosts[h].s.errors)
+			output_host_stats(h, hosts[h].name, &hosts[h].s);
+	}
+	for(i = 0; i < nurls; i++) {
+		if(urls[i].requests || urls[i].errors)
+			output_url_stats(i, url_get(ref.table, i), url_hosts[i], &urls[i]);
+	}
+}
+
+void url_stats_destroy()
+{
+	int i;
+	for(i = 0; i < nhosts; i++)
+		free(hosts[i].name);
+	free(hosts);
+	free(urls);
+	free(url_hosts);
+	table_ref_clear(&ref);
+	hosts = NULL;
+	urls = NULL;
+	url_hosts = NULL;
+	nhosts = 0;
+	nurls = 0;
+}
@@ -6,40 +6,59 @@
  */
 
 #include "util.h"
+#include <errno.h>
 #include <unistd.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/uio.h>
 
+/* The length and the message go out in one writev(), resumed where it left off
+ * if it was only partially written. */
 int msg_write(int fd, char* buf, int len)
 {
-	unsigned short msg_len = (unsigned short) len;
-	int bytes_w = 0, bytes_w_tot = 0;
-	if(write(fd, &msg_len, sizeof(msg_len)) < sizeof(msg_len)) {
-		perror("Error writing msg len");
-		return -1;
-	}
-	while(bytes_w_tot < msg_len) {
-		if ((bytes_w = write(fd, buf, msg_len)) < 0) {
+	uint32_t msg_len = (uint32_t) len;
+	struct iovec iov[2] = {
+		{ .iov_base = &msg_len, .iov_len = sizeof(msg_len) },
+		{ .iov_base = buf, .iov_len = msg_len },
+	};
+	struct iovec *v = iov;
+	int cnt = 2;
+	ssize_t bytes_w;
+	while(cnt) {
+		if((bytes_w = writev(fd, v, cnt)) < 0) {
+			if(errno == EINTR) continue;
 			perror("Error writing msg");
 			return -1;
 		}
-		bytes_w_tot += bytes_w;
+		while(cnt && bytes_w >= v->iov_len) {
+			bytes_w -= v->iov_len;
+			v++;
+			cnt--;
+		}
+		if(cnt) {
+			v->iov_base = (char *)v->iov_base + bytes_w;
+			v->iov_len -= bytes_w;
+		}
 	}
 	return 0;
 }
-int msg_read(int fd, char* buf, int max_len)
+
+static int msg_read_len(int fd, uint32_t *msg_len)
 {
-	unsigned short msg_len;
-	int bytes_r = 0, bytes_r_tot = 0;
-	if((bytes_r = read(fd, &msg_len, sizeof(msg_len))) < 0) {
+	int bytes_r;
+	if((bytes_r = read(fd, msg_len, sizeof(*msg_len))) < 0) {
 		perror("Read msg_len");
 		return -1;
-	} else if(bytes_r < sizeof(msg_len)) {
+	} else if(bytes_r < sizeof(*msg_len)) {
 		return 0;
 	}
-	if(msg_len > max_len -1) {
-		fprintf(stderr, "Got msg_len %d larger than max_len %d\n", msg_len, max_len);
-		return -1;
-	}
+	return 1;
+}
+
+static int msg_read_body(int fd, char *buf, uint32_t msg_len)
+{
+	int bytes_r = 0, bytes_r_tot = 0;
 	while(bytes_r_tot < msg_len) {
 		if((bytes_r = read(fd, buf+bytes_r_tot, msg_len-bytes_r_tot)) < 0) return -1;
 		else if(bytes_r == 0) {buf[bytes_r_tot] = '\0'; return 0;}
@@ -48,3 +67,36 @@ int msg_read(int fd, char* buf, int max_len)
 	buf[msg_len] = '\0';
 	return msg_len;
 }
+
+int msg_read(int fd, char* buf, int max_len)
+{
+	uint32_t msg_len;
+	int ret;
+	if((ret = msg_read_len(fd, &msg_len)) <= 0)
+		return ret;
+	if(msg_len > max_len -1) {
+		fprintf(stderr, "Got msg_len %u larger than max_len %d\n", msg_len, max_len);
+		return -1;
+	}
+	return msg_read_body(fd, buf, msg_len);
+}
+
+/* Like msg_read(), but grows *buf (of size *size) to fit the message. */
+int msg_read_alloc(int fd, char **buf, size_t *size)
+{
+	uint32_t msg_len;
+	char *nbuf;
+	int ret;
+	if((ret = msg_read_len(fd, &msg_len)) <= 0)
+		return ret;
+	if(msg_len + 1 > *size) {
+		nbuf = realloc(*buf, msg_len + 1);
+		if(!nbuf) {
+			perror("realloc");
+			return -1;
+		}
+		*buf = nbuf;
+		*size = msg_len + 1;
+	}
+	return msg_read_body(fd, *buf, msg_len);
+}
@@ -0,0 +1,135 @@
+/**
+ * verify.c
+ *
+ * Toke Høiland-Jørgensen
+ * 2026-10-17
+ *
+ * Checking body hashes against the ones given in the URL list, and against
+ * the ones seen before. Hashes are only kept for one URL list at a time, so
+ * the results of cycles still running on an older one are not checked.
+ */
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include "verify.h"
+#include "crc32c.h"
+#include "util.h"
+
+#define DIGEST_EXPECTED 1
+#define DIGEST_SEEN 2
+
+struct url_digest {
+	uint32_t expected;
+	uint32_t seen;
+	int flags;
+};
+
+static struct table_ref ref = TABLE_REF_INIT;
+static struct url_digest *digests = NULL;
+static int hashed = 0;
+static int checked = 0;
+static int mismatched = 0;
+static int changed = 0;
+
+/* The crc32c=<hex> field of line i, if it has one: 1 if found, 0 if not, -1
+ * if it is not a valid hash. */
+static int parse_digest(struct url_table *t, size_t i, uint32_t *digest)
+{
+	char *p = url_table_fields(t, i), *end;
+	size_t len;
+
+	while(p && *p) {
+		len = strcspn(p, " \t");
+		if(!strncmp(p, "crc32c=", 7)) {
+			if(len < 8 || len > 15 || !isxdigit((unsigned char)p[7]))
+				return -1;
+			*digest = strtoul(p + 7, &end, 16);
+			return end == p + len ? 1 : -1;
+		}
+		p += len;
+		p += strspn(p, " \t");
+	}
+	return 0;
+}
+
+static int set_table(struct url_table *t, struct url_list *l, int cycle)
+{
+	struct url_digest *d;
+	size_t i;
+	int ret = 0, found;
+
+	if(!(d = calloc(max(t->count, 1), sizeof(*d)))) {
+		perror("Unable to allocate URL digests");
+		return -1;
+	}
+	for(i = 0; i < t->count; i++) {
+		if((found = parse_digest(t, i, &d[i].expected)) < 0) {
+			fprintf(stderr, "Invalid digest given for URL: %s\n", url_get(t, i));
+			ret = -1;
+		} else if(found) {
+			d[i].flags = DIGEST_EXPECTED;
+		}
+	}
+	free(digests);
+	digests = d;
+	table_ref_set(&ref, t, l, cycle);
+	return ret;
+}
+
+/* The digests of a URL file are taken off its lines straight away, before
+ * anything else looks at them. */
+int verify_init(struct url_table *urls)
+{
+	crc32c_init();
+	return urls->count ? set_table(urls, NULL, 0) : 0;
+}
+
+/* Pick up the digests of a fetched list as soon as it arrives. */
+void verify_cycle(struct cycle *c)
+{
+	if(table_ref_newer(&ref, c->urls, c->id))
+		set_table(c->urls, c->list, c->id);
+}
+
+void verify_result(const struct cycle *c, struct result *r)
+{
+	struct url_digest *d;
+
+	r->verify = VERIFY_NONE;
+	if(r->url < 0 || r->status || c->urls != ref.table)
+		return;
+	d = &digests[r->url];
+	hashed++;
+	if(d->flags & DIGEST_EXPECTED)
+		r->verify = r->digest == d->expected ? VERIFY_OK : VERIFY_MISMATCH;
+	else if(d->flags & DIGEST_SEEN)
+		r->verify = r->digest == d->seen ? VERIFY_OK : VERIFY_CHANGED;
+
+	if(r->verify != VERIFY_NONE)
+		checked++;
+	if(r->verify == VERIFY_MISMATCH) {
+		mismatched++;
+		fprintf(stderr, "Checksum mismatch for URL '%s': CRC32C %08x, expected %08x.\n",
+			url_get(ref.table, r->url), r->digest, d->expected);
+	} else if(r->verify == VERIFY_CHANGED) {
+		changed++;
+		fprintf(stderr, "Body changed for URL '%s': CRC32C %08x, was %08x.\n",
+			url_get(ref.table, r->url), r->digest, d->seen);
+	}
+	d->seen = r->digest;
+	d->flags |= DIGEST_SEEN;
+}
+
+void verify_print(FILE *output)
+{
+	fprintf(output, "Hashed %d bodies and checked %d: %d did not match the URL list, %d changed between cycles.\n",
+		hashed, checked, mismatched, changed);
+}
+
+void verify_destroy()
+{
+	free(digests);
+	table_ref_clear(&ref);
+	digests = NULL;
+}
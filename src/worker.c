@@ -15,43 +15,29 @@
 #include <sys/wait.h>
 #include <curl/curl.h>
 #include "worker.h"
+#include "ring.h"
+#include "transfer.h"
 #include "util.h"
 
-struct memory_chunk {
-	char *memory;
-	size_t size;
-	int enabled;
-};
-
 struct worker_data {
-	int debug;
-	int timeout;
-	char *dns_servers;
-	int ai_family;
-	struct memory_chunk chunk;
+	struct options *opt;
+	struct transfer_data td;
+	struct url_table urls;
 	CURL *curl;
 	CURLcode res;
+	struct result_ring *ring;
+	struct curl_slist *resolve;
+	uint32_t seq;
+	int efd;
 	int pipe_r;
 	int pipe_w;
 };
 
-
-static size_t memory_callback(void *contents, size_t size, size_t nmemb, void *userp)
+/* Abort the transfer in progress if the parent has cancelled it. */
+static int worker_cancelled(void *ctx)
 {
-	size_t realsize = size * nmemb;
-	struct memory_chunk *chunk = userp;
-	if(!chunk->enabled) return realsize;
-
-	chunk->memory = realloc(chunk->memory, chunk->size + realsize + 1);
-	if(chunk->memory == NULL) {
-		perror("realloc");
-		return 0;
-	}
-
-	memcpy(&(chunk->memory[chunk->size]), contents, realsize);
-	chunk->size += realsize;
-	chunk->memory[chunk->size] = 0;
-	return realsize;
+	struct worker_data *data = ctx;
+	return atomic_load_explicit(&data->ring->cancel, memory_order_relaxed) == data->seq;
 }
 
 static int init_worker(struct worker_data *data)
@@ -60,172 +46,184 @@ static int init_worker(struct worker_data *data)
 	data->curl = curl_easy_init();
 	if(!data->curl)
 		return -1;
-	if(data->debug > 1 && (res = curl_easy_setopt(data->curl, CURLOPT_VERBOSE, 1L)) != CURLE_OK) {
-		fprintf(stderr, "cURL VERBOSE option error: %s\n", curl_easy_strerror(res));
-		goto out;
+	data->td.urls = NULL;
+	/* Only hedged requests are ever cancelled. */
+	if(data->opt->hedge_delay || data->opt->hedge_percentile) {
+		data->td.cancelled = worker_cancelled;
+		data->td.cancel_ctx = data;
 	}
 
-	if((res = curl_easy_setopt(data->curl, CURLOPT_FOLLOWLOCATION, 1L)) != CURLE_OK) {
-		fprintf(stderr, "cURL FOLLOWLOCATION option error: %s\n", curl_easy_strerror(res));
-		goto out;
-	}
-	if(data->timeout && (res = curl_easy_setopt(data->curl, CURLOPT_TIMEOUT_MS, data->timeout)) != CURLE_OK) {
-		fprintf(stderr, "cURL TIMEOUT_MS option error: %s\n", curl_easy_strerror(res));
-		goto out;
-	}
-	if((res = curl_easy_setopt(data->curl, CURLOPT_TCP_NODELAY, 1L)) != CURLE_OK) {
-		fprintf(stderr, "cURL TCP_NODELAY option error: %s\n", curl_easy_strerror(res));
-		goto out;
+	if((res = setup_handle(data->curl, data->opt, &data->td)) != CURLE_OK)
+		return res;
+	if(data->resolve && (res = curl_easy_setopt(data->curl, CURLOPT_RESOLVE, data->resolve)) != CURLE_OK) {
+		fprintf(stderr, "cURL RESOLVE option error: %s\n", curl_easy_strerror(res));
+		return res;
 	}
-
-	if(data->dns_servers && (res = curl_easy_setopt(data->curl, CURLOPT_DNS_SERVERS, data->dns_servers)) != CURLE_OK) {
-		fprintf(stderr, "cURL DNS_SERVERS option error: %s\n", curl_easy_strerror(res));
-		goto out;
-	}
-
-	if(data->ai_family == AF_INET && (res = curl_easy_setopt(data->curl, CURLOPT_IPRESOLVE, CURL_IPRESOLVE_V4)) != CURLE_OK) {
-		fprintf(stderr, "cURL IPRESOLVE (v4) option error: %s\n", curl_easy_strerror(res));
-		goto out;
-	}
-	if(data->ai_family == AF_INET6 && (res = curl_easy_setopt(data->curl, CURLOPT_IPRESOLVE, CURL_IPRESOLVE_V6)) != CURLE_OK) {
-		fprintf(stderr, "cURL IPRESOLVE (v6) option error: %s\n", curl_easy_strerror(res));
-		goto out;
-	}
-
-	/* send all data to this function  */
-	if((res = curl_easy_setopt(data->curl, CURLOPT_WRITEFUNCTION, memory_callback)) != CURLE_OK) {
-		fprintf(stderr, "cURL WRITEFUNCTION option error: %s\n", curl_easy_strerror(res));
-		goto out;
-	}
-
-
-	/* we pass our 'chunk' struct to the callback function */
-	if((res = curl_easy_setopt(data->curl, CURLOPT_WRITEDATA, (void *)&data->chunk)) != CURLE_OK) {
-		fprintf(stderr, "cURL WRITEDATA option error: %s\n", curl_easy_strerror(res));
-		goto out;
-	}
-
-
-	/* some servers don't like requests that are made without a user-agent
-	   field, so we provide one */
-	if((res = curl_easy_setopt(data->curl, CURLOPT_USERAGENT, "http-getter/0.1")) != CURLE_OK) {
-		fprintf(stderr, "cURL USERAGENT option error: %s\n", curl_easy_strerror(res));
-		goto out;
-	}
-
-
-	data->chunk.memory = NULL;
-	data->chunk.size = 0;
-	data->chunk.enabled = 0;
-
-out:
 	return res;
 }
 
-static size_t parse_urls(char *buf, size_t buflen, char **urls, size_t urls_l)
+static int cleanup_worker(struct worker_data *data)
 {
-	char *p, *lstart = buf;
-	int discard = 0, cp_len;
-	size_t urls_c = 0;
-	for(p = buf; p - buf <= buflen; p++) {
-		if(lstart == p && *p == '#') discard = 1;
-		if(*p == '\n' || p - buf == buflen) {
-			if(!discard && p > lstart) {
-				cp_len = min(1+p-lstart, PIPE_BUF);
-				urls[urls_c] = malloc(cp_len);
-				memcpy(urls[urls_c], lstart, cp_len);
-				urls[urls_c][cp_len-1] = '\0';
-				if(++urls_c >= urls_l) return urls_c;
-			}
-			lstart = p+1;
-			discard = 0;
-		}
-	}
-	return urls_c;
+	curl_easy_cleanup(data->curl);
+	data->curl = NULL;
+	return 0;
 }
 
 static int destroy_worker(struct worker_data *data)
 {
-	curl_easy_cleanup(data->curl);
-	free(data->chunk.memory);
+	cleanup_worker(data);
+	curl_slist_free_all(data->resolve);
+	transfer_data_destroy(&data->td);
+	url_table_destroy(&data->urls);
+	destroy_share();
 	return 0;
 }
 
+/* The names resolved up front, one CURLOPT_RESOLVE entry per line. The
+ * handle is pointed at the new entries before the old ones are freed. */
+static void set_resolve(struct worker_data *data, char *entries)
+{
+	struct curl_slist *list = NULL, *l;
+	char *line, *save = NULL;
+
+	for(line = strtok_r(entries, "\n", &save); line; line = strtok_r(NULL, "\n", &save)) {
+		if(!(l = curl_slist_append(list, line))) {
+			fprintf(stderr, "Unable to add resolve entry.\n");
+			break;
+		}
+		list = l;
+	}
+	if(data->curl)
+		curl_easy_setopt(data->curl, CURLOPT_RESOLVE, list);
+	curl_slist_free_all(data->resolve);
+	data->resolve = list;
+}
+
 static int reset_worker(struct worker_data *data)
 {
-	destroy_worker(data);
+	cleanup_worker(data);
 	return init_worker(data);
 }
 
+/* URL results go to the parent through the shared ring, followed by a wake-up
+ * on the eventfd. */
+static int send_result(struct worker_data *data, const struct result *r)
+{
+	uint64_t one = 1;
+	if(ring_push(data->ring, r)) {
+		fprintf(stderr, "Result ring full!\n");
+		return -1;
+	}
+	if(write(data->efd, &one, sizeof(one)) < 0) {
+		perror("write()");
+		return -1;
+	}
+	return 0;
+}
+
 static int run_worker(struct worker_data *data)
 {
-	char buf[PIPE_BUF+1] = {0};
+	char *buf = NULL;
+	size_t bufsize = 0;
 	char outbuf[PIPE_BUF+1] = {0};
-	char *urls[MAX_URLS];
-	size_t urls_c;
-	char *p;
-	int res, i;
+	char *p, *hdr, *eol;
+	const char *etag, *last_modified;
+	struct curl_slist *headers;
+	int res;
+	long code, left_ms;
 	ssize_t len;
-	curl_off_t bytes;
-	long header_bytes;
+	struct result r;
 	if(init_worker(data)) return -1;
 
 	while(1)
 	{
-		if((len = msg_read(data->pipe_r, buf, sizeof(buf))) == -1) {
+		if((len = msg_read_alloc(data->pipe_r, &buf, &bufsize)) == -1) {
 			return EXIT_FAILURE;
 		}
-		buf[len] = '\0';
-		if(strncmp(buf, "STOP", 4) == 0 || len == 0) return destroy_worker(data);
+		if(len == 0 || strncmp(buf, "STOP", 4) == 0) {
+			free(buf);
+			return destroy_worker(data);
+		}
+		/* There is no reply to a reset; if it fails, the next request
+		 * does. */
 		if(strncmp(buf, "RESET", 5) == 0) {
-			if((res = reset_worker(data)) != 0) {
-				len = sprintf(outbuf, "ERR %d", res);
-				msg_write(data->pipe_w, outbuf, len);
-			} else {
-				msg_write(data->pipe_w, "OK", sizeof("OK"));
-			}
+			if(reset_worker(data) != 0)
+				cleanup_worker(data);
+			continue;
+		}
+		if(strncmp(buf, "RESOLVE ", 8) == 0) {
+			set_resolve(data, buf + 8);
 			continue;
 		}
+		headers = NULL;
+		data->seq++;
 		if(strncmp(buf, "URLLIST ", 8) == 0) {
-			p = buf + 8;
-			data->chunk.enabled = 1;
+			/* Any request headers (for revalidating a cached list)
+			 * follow the URL, one per line. */
+			left_ms = strtol(buf + 8, &p, 10);
+			p++;
+			for(hdr = strchr(p, '\n'); hdr; hdr = eol) {
+				*hdr++ = '\0';
+				if((eol = strchr(hdr, '\n'))) *eol = '\0';
+				headers = curl_slist_append(headers, hdr);
+			}
+			url_table_reset(&data->urls);
+			data->td.urls = &data->urls;
 		} else if(strncmp(buf, "URL ", 4) == 0) {
-			p = buf + 4;
+			left_ms = strtol(buf + 4, &p, 10);
+			p++;
 		} else {
 			fprintf(stderr, "Unrecognised command '%s'!\n", buf);
 			break;
 		}
 
-		if(data->debug) {
+		if(data->opt->debug) {
 			fprintf(stderr, "Getting URL '%s'.\n", p);
 		}
 
-		curl_easy_setopt(data->curl, CURLOPT_URL, p);
-		data->chunk.size = 0;
-		if((res = curl_easy_perform(data->curl)) != CURLE_OK) {
+		if(data->curl) {
+			curl_easy_setopt(data->curl, CURLOPT_URL, p);
+			curl_easy_setopt(data->curl, CURLOPT_HTTPHEADER, headers);
+			set_transfer_timeout(data->curl, data->opt, left_ms);
+			transfer_start(&data->td);
+			res = curl_easy_perform(data->curl);
+			curl_easy_setopt(data->curl, CURLOPT_HTTPHEADER, NULL);
+		} else {
+			res = CURLE_FAILED_INIT;
+		}
+		curl_slist_free_all(headers);
+		result_init(&r);
+		r.status = res;
+		if(res == CURLE_OK) {
+			get_result(data->curl, &r);
+			res = transfer_result(&data->td, &r);
+		}
+		if(!data->td.urls) {
+			if(send_result(data, &r))
+				break;
+		} else if(res != CURLE_OK) {
 			len = sprintf(outbuf, "ERR %d", res);
 			msg_write(data->pipe_w, outbuf, len);
 		} else {
-			if((res = curl_easy_getinfo(data->curl, CURLINFO_SIZE_DOWNLOAD_T, &bytes)) != CURLE_OK ||
-				(res = curl_easy_getinfo(data->curl, CURLINFO_HEADER_SIZE, &header_bytes)) != CURLE_OK ) {
-				fprintf(stderr, "cURL error: %s\n", curl_easy_strerror(res));
-			}
-			if(data->chunk.enabled == 0) {
-				len = sprintf(outbuf, "OK %lu bytes", (long)bytes + header_bytes);
-				msg_write(data->pipe_w, outbuf, len);
-			} else {
-				urls_c = parse_urls(data->chunk.memory, data->chunk.size, urls, MAX_URLS);
-				len = sprintf(outbuf, "OK %lu bytes %lu urls", (long)bytes + header_bytes, (long)urls_c);
-				msg_write(data->pipe_w, outbuf, len);
-				for(i = 0; i < urls_c; i++) {
-					len = sprintf(outbuf, "%s", urls[i]);
-					msg_write(data->pipe_w, outbuf, len);
-					free(urls[i]);
-				}
-				data->chunk.enabled = 0;
-			}
+			/* The list was parsed as it came in; send it to the
+			 * parent in one go as the raw string arena, after
+			 * the status line and the cache validators. */
+			url_table_finish(&data->urls);
+			code = get_list_validators(data->curl, &etag, &last_modified);
+			if(code == 304)
+				url_table_reset(&data->urls);
+			len = sprintf(outbuf, "OK %ld bytes %lu urls %ld conns %ld %ld %ld %ld %ld %ld", r.bytes, (long)data->urls.count, r.connects,
+				      (long)r.times[TIME_NAMELOOKUP], (long)r.times[TIME_CONNECT],
+				      (long)r.times[TIME_APPCONNECT], (long)r.times[TIME_STARTTRANSFER],
+				      (long)r.times[TIME_TOTAL], code);
+			msg_write(data->pipe_w, outbuf, len);
+			len = snprintf(outbuf, sizeof(outbuf), "%s\n%s", etag ? etag : "", last_modified ? last_modified : "");
+			msg_write(data->pipe_w, outbuf, min(len, sizeof(outbuf)-1));
+			msg_write(data->pipe_w, data->urls.arena, data->urls.arena_len);
 		}
+		data->td.urls = NULL;
 	}
+	free(buf);
 	return 0;
 }
 
@@ -237,12 +235,24 @@ static struct sigaction sigdfl = {
 	.sa_handler = SIG_DFL,
 };
 
+/* SIGUSR1 only wakes up a transfer that is waiting for the network, so that
+ * it notices it has been cancelled; anything else just carries on. */
+static void sig_wake(int signal)
+{
+}
+
+static struct sigaction sigwake = {
+	.sa_handler = sig_wake,
+	.sa_flags = SA_RESTART,
+};
+
 
 int start_worker(struct worker *w, struct options *opt)
 {
 	int fds_r[2];
 	int fds_w[2];
 	int cpid;
+	sigset_t usr1, old;
 
 	w->next = NULL;
 	w->status = STATUS_READY;
@@ -252,39 +262,66 @@ int start_worker(struct worker *w, struct options *opt)
 		return EXIT_FAILURE;
 	}
 
+	if(!(w->ring = ring_create()))
+		goto err_pipes;
+
+	/* A hedge may be cancelled as soon as the worker exists; hold off
+	 * SIGUSR1 until the child has its handler for it. */
+	sigemptyset(&usr1);
+	sigaddset(&usr1, SIGUSR1);
+	sigprocmask(SIG_BLOCK, &usr1, &old);
 	cpid = fork();
+	if(cpid != 0)
+		sigprocmask(SIG_SETMASK, &old, NULL);
 	if(cpid == -1) {
 		perror("fork");
-		return EXIT_FAILURE;
+		ring_destroy(w->ring);
+		w->ring = NULL;
+		goto err_pipes;
 	}
 	if(cpid == 0) {
 		struct worker_data wd = {0};
 		wd.pipe_r = fds_w[0];
 		wd.pipe_w = fds_r[1];
-		wd.debug = opt->debug;
-		wd.timeout = opt->timeout;
-		wd.dns_servers = opt->dns_servers;
-		wd.ai_family = opt->ai_family;
+		wd.opt = opt;
+		wd.ring = w->ring;
+		wd.efd = w->efd;
 		close(fds_r[0]);
 		close(fds_w[1]);
 		sigaction(SIGINT, &sigign, NULL);
 		sigaction(SIGTERM, &sigdfl, NULL);
+		sigaction(SIGUSR1, &sigwake, NULL);
+		sigprocmask(SIG_SETMASK, &old, NULL);
 		_exit(run_worker(&wd));
 	} else {
 		w->pipe_r = fds_r[0];
 		w->pipe_w = fds_w[1];
 		w->url = NULL;
+		w->cycle = NULL;
+		w->cycle_id = -1;
+		w->seq = 0;
+		w->resolve_gen = 0;
+		w->twin = NULL;
 		close(fds_r[1]);
 		close(fds_w[0]);
 		w->pid = cpid;
 		return 0;
 	}
 	return 0;
+
+err_pipes:
+	close(fds_r[0]);
+	close(fds_r[1]);
+	close(fds_w[0]);
+	close(fds_w[1]);
+	return EXIT_FAILURE;
 }
 
 int kill_worker(struct worker *w)
 {
 	msg_write(w->pipe_w, "STOP", sizeof("STOP"));
 	waitpid(w->pid, NULL, 0);
+	ring_destroy(w->ring);
+	w->ring = NULL;
 	return 0;
 }